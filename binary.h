@@ -0,0 +1,33 @@
+#pragma once
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+template<class T>
+inline void write_value(std::ostream& os, const T& value) {
+	os.write(reinterpret_cast<const char*>(&value), sizeof value);
+}
+
+template<class T>
+inline bool read_value(std::istream& is, T& value) {
+	return static_cast<bool>(is.read(reinterpret_cast<char*>(&value), sizeof value));
+}
+
+inline void write_string(std::ostream& os, std::string_view sv) {
+	write_value(os, static_cast<std::uint32_t>(sv.size()));
+	os.write(sv.data(), sv.size());
+}
+
+inline bool read_count(std::istream& is, std::uint32_t& count, std::uint32_t max_count = 1 << 24) {
+	return read_value(is, count) && count <= max_count;
+}
+
+inline bool read_string(std::istream& is, std::string& str) {
+	std::uint32_t size;
+	if (!read_count(is, size))
+		return false;
+	str.resize(size);
+	return static_cast<bool>(is.read(str.data(), size));
+}
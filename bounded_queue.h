@@ -0,0 +1,52 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <utility>
+
+// push() blocks while the queue is full and pop() while it is empty. Both
+// give up once stop is requested or the queue has been closed; pop() still
+// drains the remaining items of a closed queue.
+template<class T>
+class bounded_queue {
+public:
+	explicit bounded_queue(std::size_t capacity)
+		: capacity(capacity) {}
+	bool push(T&& value, std::stop_token stop) {
+		std::unique_lock lock(mutex);
+		if (!not_full.wait(lock, stop, [this] { return items.size() < capacity || closed; }) || closed)
+			return false;
+		items.push_back(std::move(value));
+		lock.unlock();
+		not_empty.notify_one();
+		return true;
+	}
+	std::optional<T> pop(std::stop_token stop) {
+		std::unique_lock lock(mutex);
+		if (!not_empty.wait(lock, stop, [this] { return !items.empty() || closed; }) || items.empty())
+			return std::nullopt;
+		auto value = std::move(items.front());
+		items.pop_front();
+		lock.unlock();
+		not_full.notify_one();
+		return value;
+	}
+	void close() {
+		{
+			std::lock_guard lock(mutex);
+			closed = true;
+		}
+		not_full.notify_all();
+		not_empty.notify_all();
+	}
+private:
+	std::size_t capacity;
+	std::deque<T> items;
+	std::mutex mutex;
+	std::condition_variable_any not_full;
+	std::condition_variable_any not_empty;
+	bool closed = false;
+};
@@ -0,0 +1,209 @@
+#include "diagnostics.h"
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include "string.h"
+
+struct diagnostic_node {
+	diagnostic record;
+	diagnostic_node* next {};
+};
+
+std::string_view severity_name(severity level) {
+	switch (level) {
+	case severity::info:
+		return "INFO";
+	case severity::warning:
+		return "WARNING";
+	case severity::error:
+		return "ERROR";
+	}
+	return "";
+}
+
+void append_json_string(std::string& output, std::string_view sv) {
+	constexpr char hex_digits[] = "0123456789abcdef";
+	output += '"';
+	for (auto c : sv) {
+		switch (c) {
+		case '"':
+			output += "\\\"";
+			break;
+		case '\\':
+			output += "\\\\";
+			break;
+		case '\n':
+			output += "\\n";
+			break;
+		case '\r':
+			output += "\\r";
+			break;
+		case '\t':
+			output += "\\t";
+			break;
+		default:
+			if (static_cast<unsigned char>(c) < 0x20) {
+				output += "\\u00";
+				output += hex_digits[c >> 4 & 15];
+				output += hex_digits[c & 15];
+			} else {
+				output += c;
+			}
+		}
+	}
+	output += '"';
+}
+
+void append_diagnostic(std::string& output, const diagnostic& record, bool json) {
+	if (json) {
+		output += "{\"severity\":";
+		append_json_string(output, to_lower(severity_name(record.level)));
+		output += ",\"line\":";
+		output += std::to_string(record.line);
+		output += ",\"kind\":";
+		append_json_string(output, record.kind);
+		output += ",\"message\":";
+		append_json_string(output, record.message);
+		output += "}\n";
+		return;
+	}
+	output += severity_name(record.level);
+	if (record.line != 0) {
+		output += " (line ";
+		output += std::to_string(record.line);
+		output += ')';
+	}
+	output += ": ";
+	output += record.message;
+	output += '\n';
+}
+
+// Producers push onto a lock-free stack; the writer thread takes the whole
+// stack at once and restores the reporting order before writing it.
+class diagnostics_sink {
+public:
+	~diagnostics_sink() {
+		if (!writer.joinable())
+			return;
+		stopping.store(true);
+		signal.fetch_add(1);
+		signal.notify_one();
+		writer.join();
+	}
+	void configure(const diagnostics_options& new_options) {
+		std::lock_guard lock(options_mutex);
+		options = new_options;
+	}
+	void push(diagnostic&& record) {
+		std::call_once(started, [this] {
+			writer = std::thread([this] { run(); });
+		});
+		auto node = new diagnostic_node {.record = std::move(record), .next = head.load(std::memory_order_relaxed)};
+		while (!head.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed)) {}
+		pushed.fetch_add(1);
+		signal.fetch_add(1);
+		signal.notify_one();
+	}
+	void flush() {
+		auto target = pushed.load();
+		for (auto current = processed.load(); current < target; current = processed.load()) {
+			processed.wait(current);
+		}
+	}
+private:
+	void run() {
+		while (true) {
+			auto observed = signal.load();
+			auto list = head.exchange(nullptr, std::memory_order_acquire);
+			if (!list) {
+				if (stopping.load())
+					break;
+				signal.wait(observed);
+				continue;
+			}
+			auto batch_options = current_options();
+			diagnostic_node* ordered = nullptr;
+			while (list) {
+				auto next = list->next;
+				list->next = ordered;
+				ordered = list;
+				list = next;
+			}
+			std::string output;
+			std::uint64_t count {};
+			while (ordered) {
+				write(output, ordered->record, batch_options);
+				auto next = ordered->next;
+				delete ordered;
+				ordered = next;
+				count++;
+			}
+			std::cerr << output << std::flush;
+			processed.fetch_add(count);
+			processed.notify_all();
+		}
+		auto final_options = current_options();
+		std::string output;
+		for (const auto& [kind, count] : counts) {
+			if (final_options.max_per_kind != 0 && count > final_options.max_per_kind) {
+				diagnostic summary {.level = severity::info, .kind = "suppressed", .message = std::to_string(count - final_options.max_per_kind) + " more diagnostics of kind \"" + kind + "\" were suppressed"};
+				append_diagnostic(output, summary, final_options.json);
+			}
+		}
+		std::cerr << output << std::flush;
+	}
+	diagnostics_options current_options() {
+		std::lock_guard lock(options_mutex);
+		return options;
+	}
+	void write(std::string& output, const diagnostic& record, const diagnostics_options& write_options) {
+		if (record.level != severity::error && write_options.max_per_kind != 0) {
+			auto& count = counts[record.kind];
+			if (++count > write_options.max_per_kind)
+				return;
+		}
+		append_diagnostic(output, record, write_options.json);
+	}
+	std::atomic<diagnostic_node*> head {};
+	std::atomic<std::uint32_t> signal {};
+	std::atomic<std::uint64_t> pushed {};
+	std::atomic<std::uint64_t> processed {};
+	std::atomic<bool> stopping {};
+	std::once_flag started;
+	std::thread writer;
+	std::mutex options_mutex;
+	diagnostics_options options;
+	std::map<std::string, std::size_t> counts;
+};
+
+diagnostics_sink& get_diagnostics_sink() {
+	static diagnostics_sink sink;
+	return sink;
+}
+
+void configure_diagnostics(const diagnostics_options& options) {
+	get_diagnostics_sink().configure(options);
+}
+
+thread_local const diagnostic_handler* thread_diagnostic_handler = nullptr;
+
+void set_thread_diagnostic_handler(const diagnostic_handler* handler) {
+	thread_diagnostic_handler = handler;
+}
+
+void report_diagnostic(severity level, std::string_view kind, std::string message, std::size_t line) {
+	diagnostic record {.level = level, .line = line, .kind = std::string(kind), .message = std::move(message)};
+	if (thread_diagnostic_handler) {
+		(*thread_diagnostic_handler)(record);
+		return;
+	}
+	get_diagnostics_sink().push(std::move(record));
+}
+
+void flush_diagnostics() {
+	get_diagnostics_sink().flush();
+}
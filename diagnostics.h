@@ -0,0 +1,43 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <string_view>
+
+enum class severity {
+	info,
+	warning,
+	error,
+};
+
+struct diagnostic {
+	severity level {};
+	std::size_t line {};
+	std::string kind;
+	std::string message;
+};
+
+struct diagnostics_options {
+	bool json = false;
+	// Errors are never suppressed; 0 means no limit.
+	std::size_t max_per_kind = 0;
+};
+
+// Applies to the diagnostics written after the call; it's usually made
+// before the first one is reported.
+void configure_diagnostics(const diagnostics_options& options);
+
+// Never blocks on I/O; records are written to std::cerr by a separate
+// thread in the order they were reported. A line of 0 means the record
+// isn't tied to a playlog line.
+void report_diagnostic(severity level, std::string_view kind, std::string message, std::size_t line = 0);
+
+using diagnostic_handler = std::function<void(const diagnostic& record)>;
+
+// Diagnostics reported on the calling thread are passed to handler instead
+// of the stderr sink, and so aren't affected by configure_diagnostics. A
+// null handler restores the sink. The handler has to outlive its use.
+void set_thread_diagnostic_handler(const diagnostic_handler* handler);
+
+// Waits until everything reported so far has been written.
+void flush_diagnostics();
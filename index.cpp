@@ -0,0 +1,202 @@
+#include "index.h"
+#include <fstream>
+#include <string_view>
+#include "binary.h"
+#include "diagnostics.h"
+#include "input.h"
+#include "playlog.h"
+#include "string.h"
+
+constexpr std::uint32_t index_magic = 0x4943444a;
+constexpr std::uint32_t index_version = 3;
+
+// Consumes the declaration, leaving the "[[...]]" timestamp.
+std::optional<stats_type> stats_source_from_declaration(std::string_view& declaration) {
+	if (consume_prefix(declaration, "Game End Stats "))
+		return stats_type::end;
+	if (consume_prefix(declaration, "Game Reset Stats "))
+		return stats_type::reset;
+	if (consume_prefix(declaration, "Game Change Stats "))
+		return stats_type::change;
+	if (consume_prefix(declaration, "Current Stats "))
+		return stats_type::current;
+	return std::nullopt;
+}
+
+playlog_index build_playlog_index(std::istream& input) {
+	playlog_index result;
+	std::string line;
+	std::uint64_t offset {};
+	std::size_t line_count {};
+	bool in_team_scores = false;
+	int end_time = -1;
+	auto stats_source = stats_type::none;
+	while (std::getline(input, line)) {
+		line_count++;
+		std::string_view sv = line;
+		auto line_offset = offset;
+		offset += line.size() + 1;
+		if (is_spaces(sv))
+			continue;
+		consume_prefix(sv, "\r");
+		consume_suffix(sv, "\r");
+		auto add_entry = [&](index_entry_type type, int timestamp = -1) {
+			result.entries.push_back(index_entry {.type = type, .offset = line_offset, .line = line_count, .timestamp = timestamp});
+		};
+		auto long_timestamp = [&] {
+			if (!consume_suffix(sv, "]]") || sv.size() < 8)
+				return -1;
+			return hhmmss_to_seconds(sv.substr(sv.size() - 8)).value_or(-1);
+		};
+		bool team_score_line = false;
+		if (consume_prefix(sv, "[[")) {
+			result.levels.push_back(level_boundary {.offset = line_offset, .line = line_count, .timestamp = long_timestamp(), .previous_end_time = end_time});
+			end_time = -1;
+			stats_source = stats_type::none;
+		} else if (consume_prefix(sv, "*** ")) {
+			bool complete = consume_suffix(sv, " ***");
+			auto source = stats_source_from_declaration(sv);
+			auto timestamp = long_timestamp();
+			add_entry(index_entry_type::stats_header, timestamp);
+			if (complete && source) {
+				stats_source = *source;
+				if (timestamp >= 0 && sv.starts_with("[["))
+					end_time = timestamp;
+			}
+		} else if (consume_prefix(sv, "**Current level: ")) {
+			if (!result.levels.empty() && result.levels.back().level_filename.empty()) {
+				if (auto filename = level_filename_from_info(sv))
+					result.levels.back().level_filename = *filename;
+			}
+		} else if (sv.starts_with("[")) {
+			auto timestamp = sv.size() >= 11 && sv[9] == ']' && is_space(sv[10]) ? hhmmss_to_seconds(sv.substr(1, 8)).value_or(-1) : -1;
+			if (sv.size() >= 11)
+				sv.remove_prefix(11);
+			if (sv == ">>> Game Start" || sv.starts_with(">>> Mode: ")) {
+				add_entry(index_entry_type::game_start, timestamp);
+			} else if (sv == ">>> Game End") {
+				add_entry(index_entry_type::game_end, timestamp);
+				if (timestamp >= 0 && (stats_source == stats_type::none || stats_source == stats_type::current))
+					end_time = timestamp;
+			}
+		} else if (sv.starts_with("ID")) {
+			add_entry(index_entry_type::table_header);
+		} else if (!sv.starts_with("**") && !sv.starts_with(">>") && !is_digit(sv.front()) && sv.find(" Score: ") != std::string_view::npos) {
+			team_score_line = true;
+			if (!in_team_scores)
+				add_entry(index_entry_type::team_scores);
+		}
+		in_team_scores = team_score_line;
+	}
+	input.clear();
+	return result;
+}
+
+std::vector<level_boundary> index_level_boundaries(std::istream& input) {
+	return build_playlog_index(input).levels;
+}
+
+std::filesystem::path sidecar_index_path(const std::filesystem::path& playlog) {
+	auto result = playlog;
+	result += ".idx";
+	return result;
+}
+
+std::optional<playlog_index> load_playlog_index(const std::filesystem::path& path) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+		return std::nullopt;
+	std::uint32_t magic, version, level_count, entry_count;
+	playlog_index result;
+	if (!read_value(file, magic) || !read_value(file, version) || magic != index_magic || version != index_version)
+		return std::nullopt;
+	if (!read_value(file, result.file_size) || !read_value(file, result.file_hash) || !read_value(file, result.file_time))
+		return std::nullopt;
+	if (!read_count(file, level_count))
+		return std::nullopt;
+	result.levels.resize(level_count);
+	for (auto&& level : result.levels) {
+		std::uint64_t line;
+		if (!read_value(file, level.offset) || !read_value(file, line) || !read_value(file, level.timestamp) || !read_string(file, level.level_filename) || !read_value(file, level.previous_end_time))
+			return std::nullopt;
+		level.line = static_cast<std::size_t>(line);
+	}
+	if (!read_count(file, entry_count))
+		return std::nullopt;
+	result.entries.resize(entry_count);
+	for (auto&& entry : result.entries) {
+		std::uint64_t line;
+		if (!read_value(file, entry.type) || !read_value(file, entry.offset) || !read_value(file, line) || !read_value(file, entry.timestamp))
+			return std::nullopt;
+		entry.line = static_cast<std::size_t>(line);
+	}
+	return result;
+}
+
+bool save_playlog_index(const std::filesystem::path& path, const playlog_index& index) {
+	auto temporary_path = path;
+	temporary_path += ".tmp";
+	{
+		std::ofstream file(temporary_path, std::ios::binary);
+		write_value(file, index_magic);
+		write_value(file, index_version);
+		write_value(file, index.file_size);
+		write_value(file, index.file_hash);
+		write_value(file, index.file_time);
+		write_value(file, static_cast<std::uint32_t>(index.levels.size()));
+		for (const auto& level : index.levels) {
+			write_value(file, level.offset);
+			write_value(file, static_cast<std::uint64_t>(level.line));
+			write_value(file, level.timestamp);
+			write_string(file, level.level_filename);
+			write_value(file, level.previous_end_time);
+		}
+		write_value(file, static_cast<std::uint32_t>(index.entries.size()));
+		for (const auto& entry : index.entries) {
+			write_value(file, entry.type);
+			write_value(file, entry.offset);
+			write_value(file, static_cast<std::uint64_t>(entry.line));
+			write_value(file, entry.timestamp);
+		}
+		if (!file)
+			return false;
+	}
+	std::error_code ec;
+	std::filesystem::rename(temporary_path, path, ec);
+	return !ec;
+}
+
+std::optional<playlog_index> get_playlog_index(const std::filesystem::path& playlog, bool write_sidecar, bool verify) {
+	std::error_code size_ec, time_ec;
+	auto file_size = std::filesystem::file_size(playlog, size_ec);
+	auto file_time = std::filesystem::last_write_time(playlog, time_ec).time_since_epoch().count();
+	if (size_ec || time_ec)
+		return std::nullopt;
+	auto index_path = sidecar_index_path(playlog);
+	auto index = load_playlog_index(index_path);
+	if (index && index->file_size == file_size && index->file_time == file_time && !verify)
+		return index;
+	auto file_hash = hash_file(playlog);
+	if (!file_hash)
+		return std::nullopt;
+	if (index && index->file_size == file_size && index->file_hash == *file_hash) {
+		if (index->file_time != file_time) {
+			index->file_time = file_time;
+			if (write_sidecar && !save_playlog_index(index_path, *index))
+				report_diagnostic(severity::warning, "file access", "couldn't write index file " + index_path.string());
+		}
+		return index;
+	}
+	if (index && verify)
+		report_diagnostic(severity::info, "stale index", "index file " + index_path.string() + " doesn't match the playlog, rebuilding it");
+	std::ifstream file(playlog, std::ios::binary);
+	if (!file)
+		return std::nullopt;
+	index = build_playlog_index(file);
+	index->file_size = file_size;
+	index->file_hash = *file_hash;
+	index->file_time = file_time;
+	if (write_sidecar && !save_playlog_index(index_path, *index))
+		report_diagnostic(severity::warning, "file access", "couldn't write index file " + index_path.string());
+	return index;
+}
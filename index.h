@@ -0,0 +1,55 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <istream>
+#include <optional>
+#include <string>
+#include <vector>
+
+struct level_boundary {
+	std::uint64_t offset {};
+	std::size_t line {};
+	int timestamp = -1;
+	std::string level_filename;
+	// The parser carries the last match end time over as the start time of
+	// the next match; this is its value when the level starts.
+	int previous_end_time = -1;
+};
+
+enum class index_entry_type : std::uint8_t {
+	stats_header,
+	table_header,
+	team_scores,
+	game_start,
+	game_end,
+};
+
+struct index_entry {
+	index_entry_type type {};
+	std::uint64_t offset {};
+	std::size_t line {};
+	int timestamp = -1;
+};
+
+struct playlog_index {
+	std::uint64_t file_size {};
+	std::uint64_t file_hash {};
+	std::int64_t file_time {};
+	std::vector<level_boundary> levels;
+	std::vector<index_entry> entries;
+};
+
+// The input has to be opened in binary mode for the offsets to be usable
+// with seekg.
+playlog_index build_playlog_index(std::istream& input);
+std::vector<level_boundary> index_level_boundaries(std::istream& input);
+
+std::filesystem::path sidecar_index_path(const std::filesystem::path& playlog);
+std::optional<playlog_index> load_playlog_index(const std::filesystem::path& path);
+bool save_playlog_index(const std::filesystem::path& path, const playlog_index& index);
+
+// Uses the sidecar index if it still matches the playlog's size and
+// modification time, or its size and hash if the time changed or verify is
+// set. Otherwise rebuilds the index and, if requested, rewrites the sidecar.
+std::optional<playlog_index> get_playlog_index(const std::filesystem::path& playlog, bool write_sidecar, bool verify = false);
@@ -0,0 +1,250 @@
+#include "input.h"
+#include <array>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "diagnostics.h"
+#include "string.h"
+#if __has_include(<zlib.h>)
+#include <zlib.h>
+#define JDCSCORES_GZIP_SUPPORT
+#endif
+#if __has_include(<zstd.h>)
+#include <zstd.h>
+#define JDCSCORES_ZSTD_SUPPORT
+#endif
+
+enum class compression {
+	none,
+	gzip,
+	zstd,
+};
+
+constexpr std::size_t input_chunk_size = 1 << 16;
+constexpr std::size_t output_block_size = 1 << 18;
+constexpr std::size_t max_queued_blocks = 4;
+
+class decompressor {
+public:
+	virtual ~decompressor() = default;
+	// Consumes input from the front of the view and appends whatever it produces.
+	virtual bool decompress(std::string_view& input, std::vector<char>& output) = 0;
+	virtual bool at_frame_boundary() const = 0;
+};
+
+#ifdef JDCSCORES_GZIP_SUPPORT
+class gzip_decompressor : public decompressor {
+public:
+	gzip_decompressor() {
+		inflateInit2(&stream, 15 + 32);
+	}
+	~gzip_decompressor() override {
+		inflateEnd(&stream);
+	}
+	bool decompress(std::string_view& input, std::vector<char>& output) override {
+		auto old_size = output.size();
+		output.resize(old_size + input_chunk_size);
+		stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+		stream.avail_in = static_cast<uInt>(input.size());
+		stream.next_out = reinterpret_cast<Bytef*>(output.data() + old_size);
+		stream.avail_out = static_cast<uInt>(input_chunk_size);
+		auto status = inflate(&stream, Z_NO_FLUSH);
+		input.remove_prefix(input.size() - stream.avail_in);
+		output.resize(output.size() - stream.avail_out);
+		in_member = true;
+		// Archives made by appending gzip files contain several members.
+		if (status == Z_STREAM_END) {
+			in_member = false;
+			return inflateReset(&stream) == Z_OK;
+		}
+		return status == Z_OK || status == Z_BUF_ERROR;
+	}
+	bool at_frame_boundary() const override {
+		return !in_member;
+	}
+private:
+	z_stream stream {};
+	bool in_member = false;
+};
+#endif
+
+#ifdef JDCSCORES_ZSTD_SUPPORT
+class zstd_decompressor : public decompressor {
+public:
+	zstd_decompressor()
+		: stream(ZSTD_createDStream()) {}
+	~zstd_decompressor() override {
+		ZSTD_freeDStream(stream);
+	}
+	bool decompress(std::string_view& input, std::vector<char>& output) override {
+		auto old_size = output.size();
+		output.resize(old_size + input_chunk_size);
+		ZSTD_inBuffer in {.src = input.data(), .size = input.size(), .pos = 0};
+		ZSTD_outBuffer out {.dst = output.data() + old_size, .size = input_chunk_size, .pos = 0};
+		status = ZSTD_decompressStream(stream, &out, &in);
+		input.remove_prefix(in.pos);
+		output.resize(old_size + out.pos);
+		return !ZSTD_isError(status);
+	}
+	bool at_frame_boundary() const override {
+		return status == 0;
+	}
+private:
+	ZSTD_DStream* stream;
+	std::size_t status {};
+};
+#endif
+
+class decompressing_streambuf : public std::streambuf {
+public:
+	decompressing_streambuf(std::ifstream&& file, std::unique_ptr<decompressor> decoder)
+		: file(std::move(file)), decoder(std::move(decoder)), worker([this] { run(); }) {}
+	~decompressing_streambuf() override {
+		{
+			std::lock_guard lock(mutex);
+			stopping = true;
+		}
+		condition.notify_all();
+		worker.join();
+	}
+protected:
+	int_type underflow() override {
+		std::unique_lock lock(mutex);
+		condition.wait(lock, [this] { return !blocks.empty() || finished; });
+		if (blocks.empty()) {
+			if (failed) {
+				report_diagnostic(severity::error, "compressed input", "compressed input is corrupt or truncated");
+				failed = false;
+			}
+			return traits_type::eof();
+		}
+		current = std::move(blocks.front());
+		blocks.pop_front();
+		lock.unlock();
+		condition.notify_all();
+		setg(current.data(), current.data(), current.data() + current.size());
+		return traits_type::to_int_type(current.front());
+	}
+private:
+	void run() {
+		std::array<char, input_chunk_size> buffer;
+		std::string_view input;
+		bool success = true;
+		while (success) {
+			if (input.empty()) {
+				file.read(buffer.data(), buffer.size());
+				if (file.gcount() == 0)
+					break;
+				input = std::string_view(buffer.data(), static_cast<std::size_t>(file.gcount()));
+			}
+			std::vector<char> block;
+			block.reserve(output_block_size + input_chunk_size);
+			while (success && !input.empty() && block.size() < output_block_size) {
+				success = decoder->decompress(input, block);
+			}
+			if (!push(std::move(block)))
+				return;
+		}
+		std::lock_guard lock(mutex);
+		finished = true;
+		failed = !success || !decoder->at_frame_boundary();
+		condition.notify_all();
+	}
+	bool push(std::vector<char>&& block) {
+		if (block.empty())
+			return true;
+		std::unique_lock lock(mutex);
+		condition.wait(lock, [this] { return blocks.size() < max_queued_blocks || stopping; });
+		if (stopping)
+			return false;
+		blocks.push_back(std::move(block));
+		lock.unlock();
+		condition.notify_all();
+		return true;
+	}
+	std::ifstream file;
+	std::unique_ptr<decompressor> decoder;
+	std::vector<char> current;
+	std::deque<std::vector<char>> blocks;
+	std::mutex mutex;
+	std::condition_variable condition;
+	bool stopping = false;
+	bool finished = false;
+	bool failed = false;
+	std::thread worker;
+};
+
+class decompressing_istream : public std::istream {
+public:
+	decompressing_istream(std::ifstream&& file, std::unique_ptr<decompressor> decoder)
+		: std::istream(nullptr), buffer(std::move(file), std::move(decoder)) {
+		rdbuf(&buffer);
+	}
+private:
+	decompressing_streambuf buffer;
+};
+
+compression detect_compression(std::ifstream& file) {
+	std::array<unsigned char, 4> magic {};
+	file.read(reinterpret_cast<char*>(magic.data()), magic.size());
+	auto size = file.gcount();
+	file.clear();
+	file.seekg(0);
+	if (size >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+		return compression::gzip;
+	if (size >= 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd)
+		return compression::zstd;
+	return compression::none;
+}
+
+std::unique_ptr<std::istream> open_playlog(const std::filesystem::path& path) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+		return nullptr;
+	std::unique_ptr<decompressor> decoder;
+	switch (detect_compression(file)) {
+	case compression::none:
+		return std::make_unique<std::ifstream>(path);
+	case compression::gzip:
+#ifdef JDCSCORES_GZIP_SUPPORT
+		decoder = std::make_unique<gzip_decompressor>();
+		break;
+#else
+		report_diagnostic(severity::error, "compressed input", "this build does not support gzip-compressed input");
+		return nullptr;
+#endif
+	case compression::zstd:
+#ifdef JDCSCORES_ZSTD_SUPPORT
+		decoder = std::make_unique<zstd_decompressor>();
+		break;
+#else
+		report_diagnostic(severity::error, "compressed input", "this build does not support zstd-compressed input");
+		return nullptr;
+#endif
+	}
+	return std::make_unique<decompressing_istream>(std::move(file), std::move(decoder));
+}
+
+bool is_compressed_playlog(const std::filesystem::path& path) {
+	std::ifstream file(path, std::ios::binary);
+	return file && detect_compression(file) != compression::none;
+}
+
+std::optional<std::uint64_t> hash_file(const std::filesystem::path& path) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+		return std::nullopt;
+	auto result = fnv1a_hash("");
+	std::array<char, input_chunk_size> buffer;
+	while (file.read(buffer.data(), buffer.size()) || file.gcount() > 0) {
+		result = fnv1a_hash(std::string_view(buffer.data(), static_cast<std::size_t>(file.gcount())), result);
+	}
+	return result;
+}
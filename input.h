@@ -0,0 +1,15 @@
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <istream>
+#include <memory>
+#include <optional>
+
+// gzip and zstd archives are decompressed on a separate thread while the
+// returned stream is being read. Returns nullptr if the file can't be opened.
+std::unique_ptr<std::istream> open_playlog(const std::filesystem::path& path);
+
+bool is_compressed_playlog(const std::filesystem::path& path);
+
+// FNV-1a hash of the raw file contents.
+std::optional<std::uint64_t> hash_file(const std::filesystem::path& path);
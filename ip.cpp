@@ -0,0 +1,118 @@
+#include "ip.h"
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <iterator>
+#include "algorithm.h"
+#include "string.h"
+
+std::optional<std::uint32_t> parse_ipv4_address(std::string_view sv) {
+	std::uint32_t result {};
+	for (int i = 0; i < 4; i++) {
+		auto dot = sv.find('.');
+		if ((dot == std::string_view::npos) != (i == 3))
+			return std::nullopt;
+		auto octet = sv.substr(0, dot);
+		if (octet.empty() || octet.size() > 3 || !is_digits(octet))
+			return std::nullopt;
+		auto value = *to_int(octet);
+		if (value > 255)
+			return std::nullopt;
+		result = result << 8 | value;
+		sv.remove_prefix(dot != std::string_view::npos ? dot + 1 : sv.size());
+	}
+	return result;
+}
+
+bool parse_ipv6_groups(std::string_view sv, std::array<std::uint16_t, 8>& groups, std::size_t& count, bool allow_ipv4) {
+	count = 0;
+	if (sv.empty())
+		return true;
+	while (true) {
+		auto colon = sv.find(':');
+		auto group = sv.substr(0, colon);
+		if (colon == std::string_view::npos && allow_ipv4 && group.find('.') != std::string_view::npos) {
+			auto ipv4 = parse_ipv4_address(group);
+			if (!ipv4 || count > 6)
+				return false;
+			groups[count++] = static_cast<std::uint16_t>(*ipv4 >> 16);
+			groups[count++] = static_cast<std::uint16_t>(*ipv4);
+			return true;
+		}
+		if (group.empty() || group.size() > 4 || count == groups.size())
+			return false;
+		auto info = std::from_chars(group.data(), group.data() + group.size(), groups[count], 16);
+		if (info.ec != std::errc {} || info.ptr != group.data() + group.size())
+			return false;
+		count++;
+		if (colon == std::string_view::npos)
+			return true;
+		sv.remove_prefix(colon + 1);
+	}
+}
+
+std::optional<ip_address> parse_ip_address(std::string_view sv) {
+	if (auto ipv4 = parse_ipv4_address(sv))
+		return ip_address {.high = 0, .low = 0xffff'0000'0000ull | *ipv4};
+	std::array<std::uint16_t, 8> head {};
+	std::array<std::uint16_t, 8> tail {};
+	std::size_t head_count {};
+	std::size_t tail_count {};
+	auto gap = sv.find("::");
+	if (gap == std::string_view::npos) {
+		if (!parse_ipv6_groups(sv, head, head_count, true) || head_count != head.size())
+			return std::nullopt;
+	} else {
+		if (!parse_ipv6_groups(sv.substr(0, gap), head, head_count, false))
+			return std::nullopt;
+		if (!parse_ipv6_groups(sv.substr(gap + 2), tail, tail_count, true))
+			return std::nullopt;
+		if (head_count + tail_count >= head.size())
+			return std::nullopt;
+	}
+	std::ranges::copy(tail.begin(), tail.begin() + tail_count, head.end() - tail_count);
+	ip_address result;
+	for (std::size_t i = 0; i < 4; i++) {
+		result.high = result.high << 16 | head[i];
+		result.low = result.low << 16 | head[i + 4];
+	}
+	return result;
+}
+
+template<class T, class U>
+void insert_sorted(std::vector<T>& vector, U&& value) {
+	auto it = std::ranges::lower_bound(vector, value);
+	if (it == vector.end() || *it != value)
+		vector.emplace(it, std::forward<U>(value));
+}
+
+template<class T>
+void merge_sorted(std::vector<T>& main, std::vector<T>& secondary) {
+	if (secondary.empty())
+		return;
+	std::vector<T> result;
+	result.reserve(main.size() + secondary.size());
+	std::set_union(std::make_move_iterator(main.begin()), std::make_move_iterator(main.end()), std::make_move_iterator(secondary.begin()), std::make_move_iterator(secondary.end()), std::back_inserter(result));
+	main = std::move(result);
+	secondary.clear();
+}
+
+void ip_set::insert(std::string_view ip) {
+	if (auto address = parse_ip_address(ip))
+		insert_sorted(addresses, *address);
+	else
+		insert_sorted(unparsed, std::string(ip));
+}
+
+void ip_set::merge(ip_set& other) {
+	merge_sorted(addresses, other.addresses);
+	merge_sorted(unparsed, other.unparsed);
+}
+
+bool ip_set::overlaps(const ip_set& other) const {
+	return sets_overlap(addresses, other.addresses) || sets_overlap(unparsed, other.unparsed);
+}
+
+bool ip_set::empty() const {
+	return addresses.empty() && unparsed.empty();
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// IPv4 addresses are stored as IPv4-mapped IPv6 addresses.
+struct ip_address {
+	std::uint64_t high {};
+	std::uint64_t low {};
+	auto operator<=>(const ip_address&) const = default;
+};
+
+struct ip_address_hash {
+	std::size_t operator()(const ip_address& address) const {
+		return static_cast<std::size_t>(address.high * 0x9e3779b97f4a7c15 ^ address.low);
+	}
+};
+
+std::optional<ip_address> parse_ip_address(std::string_view sv);
+
+struct ip_set {
+	std::vector<ip_address> addresses;
+	std::vector<std::string> unparsed;
+	void insert(std::string_view ip);
+	void merge(ip_set& other);
+	bool overlaps(const ip_set& other) const;
+	bool empty() const;
+	bool operator==(const ip_set&) const = default;
+};
@@ -1,37 +1,183 @@
 #include <charconv>
+#include <cstdint>
 #include <fstream>
 #include <iostream>
+#include <limits>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <vector>
+#include "diagnostics.h"
+#include "index.h"
+#include "input.h"
 #include "match.h"
 #include "output.h"
+#include "pipeline.h"
 #include "playlog.h"
 #include "scoring.h"
+#include "season.h"
+#include "string.h"
+
+using namespace std::string_view_literals;
+
+double read_max_score() {
+	flush_diagnostics();
+	std::cout << "Set max score (default 100): " << std::flush;
+	std::string str;
+	std::getline(std::cin, str);
+	double value;
+	auto result = std::from_chars(str.data(), str.data() + str.size(), value);
+	if (result.ec == std::errc {})
+		return value;
+	return event_data {}.max_score;
+}
+
+// Parses the playlog with and without the index and checks that both
+// select the same matches.
+bool indexed_parse_is_consistent(const std::filesystem::path& path, const std::vector<level_boundary>& levels, const match_filter& filter) {
+	event_data indexed, full;
+	std::ifstream binary_file(path, std::ios::binary);
+	playlog_parser indexed_parser(indexed);
+	indexed_parser.set_filter(filter);
+	indexed_parser.parse(binary_file, levels);
+	std::ifstream text_file(path);
+	playlog_parser full_parser(full);
+	full_parser.set_filter(filter);
+	full_parser.parse(text_file);
+	return indexed.matches == full.matches;
+}
+
+struct options {
+	bool season = false;
+	bool write_index = false;
+	bool verify_index = false;
+	std::optional<std::size_t> memory_limit;
+	diagnostics_options diagnostics;
+	match_filter filter;
+	std::vector<std::filesystem::path> playlogs;
+};
+
+std::optional<options> parse_options(int argc, char* argv[]) {
+	options result;
+	for (int i = 1; i < argc; i++) {
+		std::string_view arg = argv[i];
+		if (arg == "--season") {
+			result.season = true;
+			continue;
+		}
+		if (arg == "--index") {
+			result.write_index = true;
+			continue;
+		}
+		if (arg == "--verify-index") {
+			result.verify_index = true;
+			continue;
+		}
+		if (arg == "--diagnostics-json") {
+			result.diagnostics.json = true;
+			continue;
+		}
+		if (arg == "--from" || arg == "--to" || arg == "--level" || arg == "--mode" || arg == "--max-warnings-per-kind" || arg == "--memory-limit") {
+			if (i + 1 == argc) {
+				std::cerr << "ERROR: option " << arg << " expects a value\n";
+				return std::nullopt;
+			}
+			std::string_view value = argv[++i];
+			if (arg == "--level") {
+				result.filter.levels.emplace_back(value);
+			} else if (arg == "--mode") {
+				result.filter.game_modes.emplace_back(value);
+			} else if (arg == "--max-warnings-per-kind") {
+				auto count = to_int(value);
+				if (!count || *count < 0) {
+					std::cerr << "ERROR: option " << arg << " expects a non-negative number\n";
+					return std::nullopt;
+				}
+				result.diagnostics.max_per_kind = *count;
+			} else if (arg == "--memory-limit") {
+				constexpr std::size_t megabyte = 1024 * 1024;
+				constexpr auto max_megabytes = std::numeric_limits<std::size_t>::max() / megabyte;
+				auto megabytes = to_int(value);
+				if (!megabytes || *megabytes <= 0) {
+					std::cerr << "ERROR: option " << arg << " expects a positive number of megabytes\n";
+					return std::nullopt;
+				}
+				if (static_cast<std::uint64_t>(*megabytes) > max_megabytes) {
+					std::cerr << "ERROR: option " << arg << " expects at most " << max_megabytes << " megabytes\n";
+					return std::nullopt;
+				}
+				result.memory_limit = static_cast<std::size_t>(*megabytes) * megabyte;
+			} else {
+				auto time = hhmmss_to_seconds(value);
+				if (!time) {
+					std::cerr << "ERROR: option " << arg << " expects a time in HH:MM:SS format\n";
+					return std::nullopt;
+				}
+				(arg == "--from" ? result.filter.from_time : result.filter.to_time) = *time;
+			}
+			continue;
+		}
+		if (arg.starts_with("--")) {
+			std::cerr << "ERROR: unknown option " << arg << '\n';
+			return std::nullopt;
+		}
+		result.playlogs.emplace_back(arg);
+	}
+	return result;
+}
 
 int main(int argc, char* argv[]) {
-	if (argc != 2) {
-		std::cerr << "ERROR: the program expects exactly 1 argument (playlog filename)\n";
+	auto options = parse_options(argc, argv);
+	if (!options)
+		return 1;
+	configure_diagnostics(options->diagnostics);
+	if (options->season) {
+		if (options->playlogs.empty()) {
+			std::cerr << "ERROR: season mode expects at least 1 playlog filename\n";
+			return 1;
+		}
+		if (!is_empty(options->filter)) {
+			std::cerr << "ERROR: match filters are not supported in season mode\n";
+			return 1;
+		}
+		if (options->memory_limit) {
+			std::cerr << "ERROR: --memory-limit is not supported in season mode\n";
+			return 1;
+		}
+		auto max_score = read_max_score();
+		auto results = score_season(options->playlogs, max_score, script_registry());
+		std::ofstream output("JDCscores.csv");
+		output_as_csv(output, results);
+		flush_diagnostics();
+		return 0;
+	}
+	if (options->playlogs.size() != 1) {
+		std::cerr << "ERROR: the program expects exactly 1 playlog filename\n";
 		return 1;
 	}
-	std::ifstream file(argv[1]);
-	if (!file) {
-		std::cerr << "ERROR: couldn't open file " << argv[1] << '\n';
+	const auto& path = options->playlogs.front();
+	if (!open_playlog(path)) {
+		report_diagnostic(severity::error, "file access", "couldn't open file " + path.string());
+		flush_diagnostics();
 		return 1;
 	}
-	event_data info;
-	{
-		std::cout << "Set max score (default 100): " << std::flush;
-		std::string str;
-		std::getline(std::cin, str);
-		double value;
-		auto result = std::from_chars(str.data(), str.data() + str.size(), value);
-		if (result.ec == std::errc {})
-			info.max_score = value;
+	pipeline_options pipeline {
+		.playlog = path,
+		.max_score = read_max_score(),
+		.filter = options->filter,
+		.csv_output = "JDCscores.csv",
+		.memory_limit = options->memory_limit,
+	};
+	std::optional<playlog_index> index;
+	if ((options->write_index || !is_empty(options->filter)) && !is_compressed_playlog(path))
+		index = get_playlog_index(path, options->write_index, options->verify_index);
+	if (index && !is_empty(options->filter) && options->verify_index && !indexed_parse_is_consistent(path, index->levels, options->filter)) {
+		report_diagnostic(severity::error, "stale index", "parsing with the index selects different matches than a full parse, ignoring the index");
+		index.reset();
 	}
-	playlog_parser parser(info);
-	parser.parse(file);
-	default_process(info);
-	auto results = score(info);
-	std::ofstream output("JDCscores.csv");
-	output_as_csv(output, results);
-	return 0;
+	if (index && !is_empty(options->filter))
+		pipeline.levels = std::move(index->levels);
+	auto results = scoring_pipeline(std::move(pipeline)).wait();
+	flush_diagnostics();
+	return results ? 0 : 1;
 }
@@ -1,8 +1,57 @@
 #include "match.h"
-#include <iostream>
+#include <unordered_map>
 #include "algorithm.h"
+#include "diagnostics.h"
+#include "parallel.h"
 #include "string.h"
 
+bool is_empty(const match_filter& filter) {
+	return !filter.from_time && !filter.to_time && filter.levels.empty() && filter.game_modes.empty();
+}
+
+bool is_in_circular_range(int value, int start, int end) {
+	return start <= end ? start <= value && value <= end : value >= start || value <= end;
+}
+
+bool time_ranges_overlap(int start, int end, const match_filter& filter) {
+	if (!filter.from_time && !filter.to_time)
+		return true;
+	int from = filter.from_time.value_or(0);
+	int to = filter.to_time.value_or(24 * 60 * 60 - 1);
+	return is_in_circular_range(start, from, to) || is_in_circular_range(from, start, end);
+}
+
+bool names_match(std::string_view first, std::string_view second) {
+	return std::ranges::equal(first, second, {}, to_lower_char, to_lower_char);
+}
+
+bool level_matches_filter(std::string_view level_filename, const match_filter& filter) {
+	return filter.levels.empty() || std::ranges::any_of(filter.levels, [&](std::string_view level) {
+		consume_suffix(level, ".j2l");
+		return names_match(level, level_filename);
+	});
+}
+
+bool matches_filter(const match_data& match, const match_filter& filter) {
+	if (filter.from_time || filter.to_time) {
+		int time = match.start_time >= 0 ? match.start_time : match.end_time;
+		if (time < 0 || !time_ranges_overlap(time, time, filter))
+			return false;
+	}
+	if (!level_matches_filter(match.level_filename, filter))
+		return false;
+	return filter.game_modes.empty() || std::ranges::any_of(filter.game_modes, [&](const auto& mode) {
+		return names_match(mode, match.game_mode);
+	});
+}
+
+bool is_winner(const match_data& match, const player_stats& player) {
+	if (match.team_scores.empty())
+		return match.winner == player.name;
+	std::string_view winner = match.winner;
+	return consume_suffix(winner, " Team") && winner == player.team;
+}
+
 bool is_string_with_number_suffix(std::string_view first, std::string_view second) {
 	return first.starts_with(second) && is_digits(first.substr(second.size()));
 }
@@ -12,7 +61,7 @@ bool same_player_name(std::string_view first, std::string_view second) {
 }
 
 bool players_qualify_to_auto_rename(const player_stats& first, const player_stats& second) {
-	return sets_overlap(first.ips, second.ips) && same_player_name(first.name, second.name);
+	return first.ips.overlaps(second.ips) && same_player_name(first.name, second.name);
 }
 
 bool players_qualify_to_auto_merge(const player_stats& first, const player_stats& second) {
@@ -25,12 +74,17 @@ bool prefers_secondary_name(const player_stats& first, const player_stats& secon
 	return !first.renamed && (second.renamed || is_string_with_number_suffix(first.name, second.name));
 }
 
-void merge_players(player_stats& main_player, player_stats&& secondary_player) {
+void merge_players(player_stats& main_player, player_stats&& secondary_player, std::vector<diagnostic>* deferred) {
 	if (main_player.team != secondary_player.team) {
-		if (main_player.team.empty())
+		if (main_player.team.empty()) {
 			main_player.team = std::move(secondary_player.team);
-		else if (!secondary_player.team.empty())
-			std::cerr << "WARNING: merged players have different teams - " << main_player.team << " and " << secondary_player.team << '\n';
+		} else if (!secondary_player.team.empty()) {
+			diagnostic warning {.level = severity::warning, .kind = "team mismatch", .message = "merged players have different teams - " + main_player.team + " and " + secondary_player.team};
+			if (deferred)
+				deferred->push_back(std::move(warning));
+			else
+				report_diagnostic(warning.level, warning.kind, std::move(warning.message));
+		}
 	}
 	if (prefers_secondary_name(main_player, secondary_player)) {
 		main_player.name = std::move(secondary_player.name);
@@ -48,7 +102,7 @@ void merge_players(player_stats& main_player, player_stats&& secondary_player) {
 
 void rename_player(match_data& match, std::size_t index, std::string_view name) {
 	if (index >= match.players.size()) {
-		std::cerr << "ERROR: player index out of range\n";
+		report_diagnostic(severity::error, "index out of range", "player index out of range");
 		return;
 	}
 	auto& player = match.players[index];
@@ -56,16 +110,16 @@ void rename_player(match_data& match, std::size_t index, std::string_view name)
 	player.renamed = true;
 }
 
-void merge_players(match_data& match, std::size_t first, std::size_t second) {
+void merge_players(match_data& match, std::size_t first, std::size_t second, std::vector<diagnostic>* deferred) {
 	if (first == second) {
-		std::cerr << "ERROR: cannot merge a player with themselves\n";
+		report_diagnostic(severity::error, "self merge", "cannot merge a player with themselves");
 		return;
 	}
 	if (first >= match.players.size() || second >= match.players.size()) {
-		std::cerr << "ERROR: player index out of range\n";
+		report_diagnostic(severity::error, "index out of range", "player index out of range");
 		return;
 	}
-	merge_players(match.players[first], std::move(match.players[second]));
+	merge_players(match.players[first], std::move(match.players[second]), deferred);
 	match.players.erase(match.players.begin() + second);
 }
 
@@ -75,7 +129,7 @@ void set_game_mode(match_data& match, std::string_view mode) {
 
 void remove_player(match_data& match, std::size_t index) {
 	if (index >= match.players.size()) {
-		std::cerr << "ERROR: player index out of range\n";
+		report_diagnostic(severity::error, "index out of range", "player index out of range");
 		return;
 	}
 	match.players.erase(match.players.begin() + index);
@@ -83,35 +137,83 @@ void remove_player(match_data& match, std::size_t index) {
 
 void remove_match(event_data& event, std::size_t index) {
 	if (index >= event.matches.size()) {
-		std::cerr << "ERROR: match index out of range\n";
+		report_diagnostic(severity::error, "index out of range", "match index out of range");
 		return;
 	}
 	event.matches.erase(event.matches.begin() + index);
 }
 
-void default_process(event_data& event) {
-	for (auto&& match : event.matches) {
-		for (std::size_t i = 0; i < match.players.size(); i++) {
-			const auto& first = match.players[i];
-			for (std::size_t j = i + 1; j < match.players.size(); j++) {
-				const auto& second = match.players[j];
-				if (players_qualify_to_auto_merge(first, second)) {
-					merge_players(match, i, j);
-					j--;
-				}
+void auto_merge_players(match_data& match, std::vector<diagnostic>* deferred) {
+	for (std::size_t i = 0; i < match.players.size(); i++) {
+		const auto& first = match.players[i];
+		for (std::size_t j = i + 1; j < match.players.size(); j++) {
+			const auto& second = match.players[j];
+			if (players_qualify_to_auto_merge(first, second)) {
+				merge_players(match, i, j, deferred);
+				j--;
 			}
 		}
 	}
+}
+
+void auto_rename_players(const std::vector<player_stats*>& players) {
+	// Only players sharing an IP address can qualify for a rename, so the
+	// candidates are gathered in parallel from per-address buckets while the
+	// renames themselves are applied serially in the original order.
+	std::unordered_map<ip_address, std::vector<std::size_t>, ip_address_hash> players_by_ip;
+	std::unordered_map<std::string_view, std::vector<std::size_t>> players_by_unparsed_ip;
+	for (std::size_t i = 0; i < players.size(); i++) {
+		for (const auto& ip : players[i]->ips.addresses) {
+			players_by_ip[ip].push_back(i);
+		}
+		for (const auto& ip : players[i]->ips.unparsed) {
+			players_by_unparsed_ip[ip].push_back(i);
+		}
+	}
+	std::vector<std::vector<std::size_t>> candidates(players.size());
+	parallel_for_each(candidates, [&](std::vector<std::size_t>& player_candidates) {
+		auto index = &player_candidates - candidates.data();
+		auto add_bucket = [&](const auto& buckets, const auto& ip) {
+			const auto& bucket = buckets.find(ip)->second;
+			player_candidates.insert(player_candidates.end(), bucket.begin(), bucket.end());
+		};
+		for (const auto& ip : players[index]->ips.addresses) {
+			add_bucket(players_by_ip, ip);
+		}
+		for (const auto& ip : players[index]->ips.unparsed) {
+			add_bucket(players_by_unparsed_ip, ip);
+		}
+		std::ranges::sort(player_candidates);
+		auto duplicates = std::ranges::unique(player_candidates);
+		player_candidates.erase(duplicates.begin(), duplicates.end());
+	});
+	for (std::size_t i = 0; i < players.size(); i++) {
+		auto& player = *players[i];
+		for (auto j : candidates[i]) {
+			const auto& other = *players[j];
+			if (prefers_secondary_name(player, other) && players_qualify_to_auto_rename(player, other))
+				player.name = other.name;
+		}
+	}
+}
+
+void default_process(event_data& event) {
+	// Warnings are collected per match and reported afterwards so that their
+	// order doesn't depend on how the matches were scheduled.
+	std::vector<std::vector<diagnostic>> merge_diagnostics(event.matches.size());
+	parallel_for_each(event.matches, [&](match_data& match) {
+		auto_merge_players(match, &merge_diagnostics[&match - event.matches.data()]);
+	});
+	for (auto&& diagnostics : merge_diagnostics) {
+		for (auto&& record : diagnostics) {
+			report_diagnostic(record.level, record.kind, std::move(record.message), record.line);
+		}
+	}
 	std::vector<player_stats*> all_players;
 	for (auto&& match : event.matches) {
 		for (auto&& player : match.players) {
 			all_players.push_back(&player);
 		}
 	}
-	for (const auto& player : all_players) {
-		for (const auto& other : all_players) {
-			if (prefers_secondary_name(*player, *other) && players_qualify_to_auto_rename(*player, *other))
-				player->name = other->name;
-		}
-	}
+	auto_rename_players(all_players);
 }
@@ -1,9 +1,12 @@
 #pragma once
+#include <functional>
 #include <map>
-#include <set>
+#include <optional>
 #include <string>
 #include <string_view>
 #include <vector>
+#include "diagnostics.h"
+#include "ip.h"
 
 enum class stats_type {
 	none,
@@ -16,14 +19,16 @@ enum class stats_type {
 struct stat_value {
 	int value {};
 	bool ordinal {};
+	bool operator==(const stat_value&) const = default;
 };
 
 struct player_stats {
 	std::string name;
 	bool renamed {};
-	std::set<std::string> ips;
+	ip_set ips;
 	std::string team;
-	std::map<std::string, stat_value> stats;
+	std::map<std::string, stat_value, std::less<>> stats;
+	bool operator==(const player_stats&) const = default;
 };
 
 struct match_data {
@@ -35,6 +40,16 @@ struct match_data {
 	stats_type stats_source = stats_type::none;
 	int start_time = -1;
 	int end_time = -1;
+	bool operator==(const match_data&) const = default;
+};
+
+// Times are seconds since midnight; a window with from_time > to_time wraps
+// around midnight. Levels and game modes are compared case-insensitively.
+struct match_filter {
+	std::optional<int> from_time;
+	std::optional<int> to_time;
+	std::vector<std::string> levels;
+	std::vector<std::string> game_modes;
 };
 
 struct event_data {
@@ -49,17 +64,25 @@ constexpr int duration(const match_data& match) {
 	return result;
 }
 
+bool is_empty(const match_filter& filter);
+bool time_ranges_overlap(int start, int end, const match_filter& filter);
+bool level_matches_filter(std::string_view level_filename, const match_filter& filter);
+bool matches_filter(const match_data& match, const match_filter& filter);
+bool is_winner(const match_data& match, const player_stats& player);
 bool is_string_with_number_suffix(std::string_view first, std::string_view second);
 bool same_player_name(std::string_view first, std::string_view second);
 bool players_qualify_to_auto_rename(const player_stats& first, const player_stats& second);
 bool players_qualify_to_auto_merge(const player_stats& first, const player_stats& second);
 bool prefers_secondary_name(const player_stats& first, const player_stats& second);
-void merge_players(player_stats& main_player, player_stats&& secondary_player);
+void merge_players(player_stats& main_player, player_stats&& secondary_player, std::vector<diagnostic>* deferred = nullptr);
 
 void rename_player(match_data& match, std::size_t index, std::string_view name);
-void merge_players(match_data& match, std::size_t first, std::size_t second);
+void merge_players(match_data& match, std::size_t first, std::size_t second, std::vector<diagnostic>* deferred = nullptr);
 void set_game_mode(match_data& match, std::string_view mode);
 void remove_player(match_data& match, std::size_t index);
 void remove_match(event_data& event, std::size_t index);
 
+// Warnings are appended to deferred instead of being reported if it is set.
+void auto_merge_players(match_data& match, std::vector<diagnostic>* deferred = nullptr);
+void auto_rename_players(const std::vector<player_stats*>& players);
 void default_process(event_data& event);
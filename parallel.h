@@ -0,0 +1,36 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <ranges>
+#include <thread>
+#include <vector>
+#ifdef _MSC_VER
+#include <execution>
+#endif
+
+// MSVC's parallel algorithms come with its runtime. libstdc++ implements them
+// on top of TBB, which would have to be linked in, so other compilers split
+// the range across threads instead.
+template<std::ranges::random_access_range R, class F>
+inline void parallel_for_each(R&& r, F f) {
+#ifdef _MSC_VER
+	std::for_each(std::execution::par, std::ranges::begin(r), std::ranges::end(r), f);
+#else
+	auto first = std::ranges::begin(r);
+	auto size = static_cast<std::size_t>(std::ranges::distance(r));
+	auto thread_count = std::min<std::size_t>(std::max(std::thread::hardware_concurrency(), 1u), size);
+	if (thread_count <= 1) {
+		std::ranges::for_each(r, f);
+		return;
+	}
+	std::vector<std::jthread> threads;
+	threads.reserve(thread_count);
+	for (std::size_t i = 0; i < thread_count; i++) {
+		auto chunk_begin = first + size * i / thread_count;
+		auto chunk_end = first + size * (i + 1) / thread_count;
+		threads.emplace_back([chunk_begin, chunk_end, &f] {
+			std::for_each(chunk_begin, chunk_end, f);
+		});
+	}
+#endif
+}
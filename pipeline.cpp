@@ -0,0 +1,199 @@
+#include "pipeline.h"
+#include <fstream>
+#include <istream>
+#include <streambuf>
+#include <utility>
+#include "diagnostics.h"
+#include "input.h"
+#include "output.h"
+#include "playlog.h"
+
+constexpr std::size_t pipeline_block_size = 1 << 16;
+
+class queue_streambuf : public std::streambuf {
+public:
+	queue_streambuf(bounded_queue<std::string>& blocks, std::stop_token stop)
+		: blocks(blocks), stop(std::move(stop)) {}
+protected:
+	int_type underflow() override {
+		auto block = blocks.pop(stop);
+		if (!block)
+			return traits_type::eof();
+		current = std::move(*block);
+		setg(current.data(), current.data(), current.data() + current.size());
+		return traits_type::to_int_type(current.front());
+	}
+private:
+	bounded_queue<std::string>& blocks;
+	std::stop_token stop;
+	std::string current;
+};
+
+class queue_istream : public std::istream {
+public:
+	queue_istream(bounded_queue<std::string>& blocks, std::stop_token stop)
+		: std::istream(nullptr), buffer(blocks, std::move(stop)) {
+		rdbuf(&buffer);
+	}
+private:
+	queue_streambuf buffer;
+};
+
+scoring_pipeline::scoring_pipeline(pipeline_options new_options, pipeline_callbacks new_callbacks)
+	: options(std::move(new_options)), callbacks(std::move(new_callbacks)), scripts(options.scripts_directory), blocks(options.queue_capacity), parsed_matches(options.queue_capacity), scored_matches(options.queue_capacity) {
+	if (callbacks.diagnostic_reported) {
+		diagnostics = [this](const diagnostic& record) {
+			invoke_callback([&] { callbacks.diagnostic_reported(record); });
+		};
+	}
+	if (options.memory_limit)
+		collector.emplace(scripts, *options.memory_limit);
+	auto stop = stop_source.get_token();
+	stages.emplace_back([this, stop] { run_stage(&scoring_pipeline::read_stage, stop); });
+	stages.emplace_back([this, stop] { run_stage(&scoring_pipeline::parse_stage, stop); });
+	stages.emplace_back([this, stop] { run_stage(&scoring_pipeline::score_stage, stop); });
+	stages.emplace_back([this, stop] { run_stage(&scoring_pipeline::collect_stage, stop); });
+}
+
+scoring_pipeline::~scoring_pipeline() {
+	cancel();
+	join();
+}
+
+void scoring_pipeline::cancel() {
+	stop_source.request_stop();
+}
+
+std::optional<scoring_results> scoring_pipeline::wait() {
+	join();
+	if (callback_exception)
+		std::rethrow_exception(std::exchange(callback_exception, nullptr));
+	return std::exchange(results, std::nullopt);
+}
+
+void scoring_pipeline::join() {
+	for (auto&& stage : stages) {
+		if (stage.joinable())
+			stage.join();
+	}
+}
+
+// Callbacks run one at a time. An exception cancels the pipeline instead of
+// unwinding the stage, and is kept for wait().
+template<class F>
+void scoring_pipeline::invoke_callback(F&& f) {
+	std::lock_guard lock(callback_mutex);
+	try {
+		f();
+	} catch (...) {
+		if (!callback_exception)
+			callback_exception = std::current_exception();
+		cancel();
+	}
+}
+
+void scoring_pipeline::run_stage(void (scoring_pipeline::*stage)(std::stop_token), std::stop_token stop) {
+	if (diagnostics)
+		set_thread_diagnostic_handler(&diagnostics);
+	(this->*stage)(std::move(stop));
+}
+
+void scoring_pipeline::read_stage(std::stop_token stop) {
+	// Indexed levels are read by the parse stage, which has to seek.
+	if (options.levels) {
+		blocks.close();
+		return;
+	}
+	auto file = open_playlog(options.playlog);
+	if (!file) {
+		report_diagnostic(severity::error, "file access", "couldn't open file " + options.playlog.string());
+		failed = true;
+	}
+	while (file && !stop.stop_requested()) {
+		std::string block(pipeline_block_size, '\0');
+		file->read(block.data(), block.size());
+		block.resize(static_cast<std::size_t>(file->gcount()));
+		if (block.empty() || !blocks.push(std::move(block), stop))
+			break;
+	}
+	blocks.close();
+}
+
+void scoring_pipeline::parse_stage(std::stop_token stop) {
+	event_data event;
+	playlog_parser parser(event);
+	parser.set_filter(options.filter);
+	parser.set_match_sink([&](match_data&& match) {
+		parsed_matches.push(std::move(match), stop);
+	});
+	if (options.levels) {
+		std::ifstream file(options.playlog, std::ios::binary);
+		if (file) {
+			parser.parse(file, *options.levels);
+		} else {
+			report_diagnostic(severity::error, "file access", "couldn't open file " + options.playlog.string());
+			failed = true;
+		}
+	} else {
+		queue_istream input(blocks, stop);
+		parser.parse(input);
+	}
+	parsed_matches.close();
+}
+
+void scoring_pipeline::score_stage(std::stop_token stop) {
+	while (auto match = parsed_matches.pop(stop)) {
+		scored_match scored {.match = std::move(*match)};
+		if (collector) {
+			auto_merge_players(scored.match);
+			scored.scores = score_match(scored.match, scripts, &statistics);
+		}
+		if (!scored_matches.push(std::move(scored), stop))
+			break;
+	}
+	scored_matches.close();
+}
+
+void scoring_pipeline::collect_stage(std::stop_token stop) {
+	event_data event {.max_score = options.max_score};
+	while (auto scored = scored_matches.pop(stop)) {
+		if (!collector) {
+			event.matches.push_back(std::move(scored->match));
+			continue;
+		}
+		if (callbacks.match_scored)
+			invoke_callback([&] { callbacks.match_scored(scored->match, scored->scores); });
+		collector->add_scored_match(std::move(scored->match), scored->scores);
+	}
+	if (stop.stop_requested() || failed)
+		return;
+	if (collector) {
+		report_script_statistics(statistics);
+		results = collector->finish(options.max_score);
+	} else {
+		results = collect_event(event);
+	}
+	if (options.csv_output) {
+		std::ofstream output(*options.csv_output);
+		output_as_csv(output, *results);
+		if (!output)
+			report_diagnostic(severity::error, "file access", "couldn't write file " + options.csv_output->string());
+	}
+	if (callbacks.finished)
+		invoke_callback([&] { callbacks.finished(*results); });
+}
+
+// The same as default_process followed by score, except that every match's
+// scores are also passed to match_scored.
+scoring_results scoring_pipeline::collect_event(event_data& event) {
+	default_process(event);
+	score_aggregator aggregator;
+	for (const auto& match : event.matches) {
+		auto scores = score_match(match, scripts, &statistics);
+		if (callbacks.match_scored)
+			invoke_callback([&] { callbacks.match_scored(match, scores); });
+		aggregator.add_round(match.level_filename, match.game_mode, duration(match), std::move(scores));
+	}
+	report_script_statistics(statistics);
+	return aggregator.finish(event.max_score);
+}
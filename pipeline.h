@@ -0,0 +1,94 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "bounded_queue.h"
+#include "diagnostics.h"
+#include "index.h"
+#include "match.h"
+#include "scoring.h"
+#include "streaming.h"
+
+struct pipeline_options {
+	std::filesystem::path playlog;
+	double max_score = 100.0;
+	match_filter filter;
+	// The playlog's levels, e.g. from its index. If set, only the levels the
+	// filter can select are read.
+	std::optional<std::vector<level_boundary>> levels;
+	std::filesystem::path scripts_directory = "scoring";
+	// The results are also written here as CSV if set.
+	std::optional<std::filesystem::path> csv_output;
+	// Without a limit, the matches are kept until the playlog has been parsed
+	// and are then processed like default_process and score do. With one,
+	// they're merged and scored as soon as they're parsed, like
+	// streaming_scorer does.
+	std::optional<std::size_t> memory_limit;
+	std::size_t queue_capacity = 16;
+};
+
+// Invoked on the pipeline's own threads, one call at a time. If a callback
+// throws, the pipeline is cancelled and wait() rethrows the exception.
+struct pipeline_callbacks {
+	// Without a memory limit, this is only invoked once all matches have been
+	// parsed and renamed.
+	std::function<void(const match_data& match, const std::map<std::string, double>& scores)> match_scored;
+	std::function<void(const scoring_results& results)> finished;
+	// If set, receives the diagnostics reported by the pipeline instead of
+	// std::cerr.
+	std::function<void(const diagnostic& record)> diagnostic_reported;
+};
+
+struct scored_match {
+	match_data match;
+	std::map<std::string, double> scores;
+};
+
+// Reading, parsing, merging and scoring, and collecting the results each run
+// on their own thread, with bounded queues in between so that a slow stage
+// holds back the ones in front of it.
+class scoring_pipeline {
+public:
+	explicit scoring_pipeline(pipeline_options options, pipeline_callbacks callbacks = {});
+	scoring_pipeline(const scoring_pipeline&) = delete;
+	scoring_pipeline& operator=(const scoring_pipeline&) = delete;
+	~scoring_pipeline();
+	// Stops all stages as soon as possible. Destroying the pipeline cancels it too.
+	void cancel();
+	// Blocks until all stages are done. Returns nullopt if the pipeline was
+	// cancelled or the playlog couldn't be read.
+	std::optional<scoring_results> wait();
+private:
+	void run_stage(void (scoring_pipeline::*stage)(std::stop_token), std::stop_token stop);
+	void read_stage(std::stop_token stop);
+	void parse_stage(std::stop_token stop);
+	void score_stage(std::stop_token stop);
+	void collect_stage(std::stop_token stop);
+	scoring_results collect_event(event_data& event);
+	template<class F>
+	void invoke_callback(F&& f);
+	void join();
+	pipeline_options options;
+	pipeline_callbacks callbacks;
+	diagnostic_handler diagnostics;
+	script_registry scripts;
+	std::optional<streaming_scorer> collector;
+	script_statistics_map statistics;
+	bounded_queue<std::string> blocks;
+	bounded_queue<match_data> parsed_matches;
+	bounded_queue<scored_match> scored_matches;
+	std::atomic<bool> failed {};
+	std::optional<scoring_results> results;
+	std::recursive_mutex callback_mutex;
+	std::exception_ptr callback_exception;
+	std::stop_source stop_source;
+	std::vector<std::jthread> stages;
+};
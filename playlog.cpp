@@ -1,15 +1,45 @@
 #include <algorithm>
 #include <cctype>
-#include <iostream>
 #include <iterator>
+#include <limits>
+#include <unordered_map>
 #include <utility>
+#include "diagnostics.h"
 #include "playlog.h"
 #include "string.h"
 
 using namespace std::string_view_literals;
 
+std::optional<std::string_view> level_filename_from_info(std::string_view value) {
+	auto quote_index = value.rfind("\" - ");
+	if (quote_index == std::string_view::npos)
+		return std::nullopt;
+	auto filename = value.substr(quote_index + 4);
+	consume_suffix(filename, ".j2l");
+	return filename;
+}
+
+playlog_parser::column_info playlog_parser::make_column(std::string header, std::size_t size) {
+	auto key = to_lower(header);
+	auto separator = ' ' + header + ": ";
+	auto kind = column_kind::stat;
+	if (header == "ID")
+		kind = column_kind::id;
+	else if (header == "Name")
+		kind = column_kind::name;
+	else if (header == "IP Address")
+		kind = column_kind::ip_address;
+	else if (header == "Team")
+		kind = column_kind::team;
+	return column_info {.header = std::move(header), .key = std::move(key), .separator = std::move(separator), .size = size, .kind = kind};
+}
+
 void playlog_parser::report_warning(std::string_view message) {
-	std::cerr << "WARNING (line " << line_count << "): " << message << '\n';
+	report_warning(message, std::string(message));
+}
+
+void playlog_parser::report_warning(std::string_view kind, std::string message) {
+	report_diagnostic(severity::warning, kind, std::move(message), line_count);
 }
 
 void playlog_parser::interpret_long_timestamp_line(std::string_view line) {
@@ -61,14 +91,12 @@ void playlog_parser::interpret_info_line(std::string_view line) {
 	auto key = line.substr(0, colon_index);
 	auto value = line.substr(colon_index + 2);
 	if (key == "Current level") {
-		auto quote_index = value.rfind("\" - ");
-		if (quote_index == std::string_view::npos) {
+		auto filename = level_filename_from_info(value);
+		if (!filename) {
 			report_warning("unexpected level name format");
 			return;
 		}
-		auto filename = value.substr(quote_index + 4);
-		consume_suffix(filename, ".j2l");
-		level_filename = filename;
+		level_filename = *filename;
 		return;
 	}
 	if (key == "Next level")
@@ -121,7 +149,7 @@ void playlog_parser::interpret_player_leave(std::string_view line) {
 	for (auto it = table_header.begin(); it != table_header.end(); ++it) {
 		const auto& header = it->header;
 		if (!consume_prefix(line, header)) {
-			report_warning("expected \"" + header + '"');
+			report_warning("expected column", "expected \"" + header + '"');
 			return;
 		}
 		if (!consume_prefix(line, ": ")) {
@@ -131,31 +159,29 @@ void playlog_parser::interpret_player_leave(std::string_view line) {
 				return;
 			}
 		}
-		if (header != "Name") {
+		if (it->kind != column_kind::name) {
 			auto space_index = line.find_first_of(" \t");
-			bool success = interpret_table_cell(line.substr(0, space_index), header, stats);
+			bool success = interpret_table_cell(line.substr(0, space_index), *it, stats);
 			if (!success)
 				return;
 			line = space_index != std::string_view::npos ? without_leading_whitespace(line.substr(space_index)) : ""sv;
 		} else {
 			std::size_t space_index = std::string_view::npos;
 			if (auto next = std::next(it); next != table_header.end()) {
-				const auto& next_header = next->header;
-				auto key = ' ' + next_header + ": ";
-				space_index = line.rfind(key);
+				space_index = line.rfind(next->separator);
 				if (space_index == std::string_view::npos) {
-					report_warning("expected \"" + next_header + '"');
+					report_warning("expected column", "expected \"" + next->header + '"');
 					return;
 				}
 			}
-			bool success = interpret_table_cell(without_trailing_whitespace(line.substr(0, space_index)), header, stats);
+			bool success = interpret_table_cell(without_trailing_whitespace(line.substr(0, space_index)), *it, stats);
 			if (!success)
 				return;
 			if (space_index != std::string_view::npos)
 				line.remove_prefix(space_index + 1);
 		}
 	}
-	match.players.push_back(std::move(stats));
+	add_player(std::move(stats));
 }
 
 void playlog_parser::interpret_event_line(std::string_view line) {
@@ -207,40 +233,42 @@ void playlog_parser::interpret_table_header_line(std::string_view line) {
 		return;
 	table_header.clear();
 	while (!line.empty()) {
-		column_info column;
+		std::string header;
+		std::size_t size {};
 		for (const auto& special_header : {"IP Address"sv, "Player Name"sv}) {
 			if (consume_prefix(line, special_header)) {
-				column.header = special_header.substr(special_header.starts_with("Player ") ? 7 : 0);
-				column.size = special_header.size();
+				header = special_header.substr(special_header.starts_with("Player ") ? 7 : 0);
+				size = special_header.size();
 			}
 		}
 		while (!line.empty() && !is_space(line.front())) {
-			column.header.push_back(line.front());
-			column.size++;
+			header.push_back(line.front());
+			size++;
 			line.remove_prefix(1);
 		}
 		while (!line.empty() && is_space(line.front())) {
-			column.size++;
+			size++;
 			line.remove_prefix(1);
 		}
-		table_header.push_back(std::move(column));
+		table_header.push_back(make_column(std::move(header), size));
 	}
 }
 
-bool playlog_parser::interpret_table_cell(std::string_view cell, std::string_view label, player_stats& stats) {
-	if (label == "ID")
+bool playlog_parser::interpret_table_cell(std::string_view cell, const column_info& column, player_stats& stats) {
+	switch (column.kind) {
+	case column_kind::id:
 		return true;
-	if (label == "Name") {
+	case column_kind::name:
 		stats.name = cell;
 		return true;
-	}
-	if (label == "IP Address") {
-		stats.ips.emplace(cell);
+	case column_kind::ip_address:
+		stats.ips.insert(cell);
 		return true;
-	}
-	if (label == "Team") {
+	case column_kind::team:
 		stats.team = cell;
 		return true;
+	case column_kind::stat:
+		break;
 	}
 	bool ordinal = cell == "N/A";
 	for (const auto& ordinal_suffix : {"th", "st", "nd", "rd"}) {
@@ -249,13 +277,19 @@ bool playlog_parser::interpret_table_cell(std::string_view cell, std::string_vie
 	}
 	auto numeric_value = cell != "N/A" ? to_int(cell) : 0;
 	if (!numeric_value) {
-		report_warning("could not parse the value in column \"" + std::string(label) + '"');
+		report_warning("could not parse value", "could not parse the value in column \"" + column.header + '"');
 		return false;
 	}
-	stats.stats[to_lower(label)] = {.value = *numeric_value, .ordinal = ordinal};
+	stats.stats[column.key] = {.value = *numeric_value, .ordinal = ordinal};
 	return true;
 }
 
+void playlog_parser::add_player(player_stats&& stats) {
+	if (match.players.empty())
+		match.players.reserve(player_count_hint);
+	match.players.push_back(std::move(stats));
+}
+
 void playlog_parser::interpret_table_row_line(std::string_view line) {
 	if (stats_source == stats_type::none) {
 		report_warning("unexpected table row");
@@ -275,11 +309,11 @@ void playlog_parser::interpret_table_row_line(std::string_view line) {
 			return;
 		}
 		line.remove_prefix(cell.size());
-		bool success = interpret_table_cell(without_trailing_whitespace(cell), column.header, stats);
+		bool success = interpret_table_cell(without_trailing_whitespace(cell), column, stats);
 		if (!success)
 			return;
 	}
-	match.players.push_back(std::move(stats));
+	add_player(std::move(stats));
 }
 
 void playlog_parser::interpret_team_score_line(std::string_view line, std::size_t name_length) {
@@ -337,45 +371,51 @@ void playlog_parser::interpret_line(std::string_view line) {
 	report_warning("unrecognized line type");
 }
 
+// Appends the word in front of every colon, e.g. "ID" and "Name" for "ID: 1 Name: Foo".
+void tokenize_leave_keys(std::string_view line, std::vector<std::string_view>& keys) {
+	std::size_t word_start = 0;
+	for (std::size_t i = 0; i < line.size(); i++) {
+		if (line[i] == ' ')
+			word_start = i + 1;
+		else if (line[i] == ':')
+			keys.push_back(line.substr(word_start, i - word_start));
+	}
+}
+
 void playlog_parser::generate_table_header_from_leaving_players() {
-	std::cerr << "INFO (line " << leaving_players.front().number << "): match has leaving players but no game stats\n";
-	std::cerr << "INFO: this may lead to unexpected results if all player names contain colons\n";
+	report_diagnostic(severity::info, "missing game stats", "match has leaving players but no game stats", leaving_players.front().number);
+	report_diagnostic(severity::info, "missing game stats", "this may lead to unexpected results if all player names contain colons");
+	struct key_count {
+		std::size_t lines {};
+		std::size_t last_line {};
+	};
+	std::unordered_map<std::string_view, key_count> counts;
+	std::vector<std::string_view> keys;
 	std::vector<std::string_view> result;
-	for (const auto& leaving_player : leaving_players) {
-		std::vector<std::string_view> header;
-		const auto& line = leaving_player.line;
-		for (auto colon = line.find(':'); colon != std::string::npos; colon = line.find(':', colon + 1)) {
-			auto start = line.rfind(' ', colon) + 1;
-			header.emplace_back(line.begin() + start, line.begin() + colon);
-		}
-		if (result.empty()) {
-			result = std::move(header);
-		} else {
-			std::vector<std::string_view> intersection;
-			auto first = result.begin();
-			auto second = header.begin();
-			while (first != result.end() && second != header.end()) {
-				if (*first == *second) {
-					intersection.push_back(*first);
-					++first;
-					++second;
-				} else {
-					auto first_remaining = std::distance(first, result.end());
-					auto second_remaining = std::distance(second, header.end());
-					if (first_remaining >= second_remaining)
-						++first;
-					if (first_remaining <= second_remaining)
-						++second;
-				}
+	for (std::size_t i = 0; i < leaving_players.size(); i++) {
+		keys.clear();
+		tokenize_leave_keys(leaving_players[i].line, keys);
+		for (auto key : keys) {
+			auto& count = counts[key];
+			if (count.lines == 0 || count.last_line != i) {
+				count.lines++;
+				count.last_line = i;
+			} else if (i == 0) {
+				// Keys repeated because of a name with colons: the column itself comes last.
+				std::erase(result, key);
 			}
-			result = std::move(intersection);
+			if (i == 0)
+				result.push_back(key);
 		}
 	}
+	std::erase_if(result, [&](std::string_view key) {
+		return counts[key].lines != leaving_players.size();
+	});
 	auto address = std::ranges::find(result, "Address");
 	if (address != result.end())
 		*address = "IP Address";
 	for (const auto& column_name : result) {
-		table_header.push_back(column_info {.header = std::string(column_name)});
+		table_header.push_back(make_column(std::string(column_name)));
 	}
 }
 
@@ -383,6 +423,7 @@ void playlog_parser::finalize_table() {
 	auto original_line_count = line_count;
 	if (table_header.empty() && !leaving_players.empty())
 		generate_table_header_from_leaving_players();
+	match.players.reserve(match.players.size() + leaving_players.size());
 	for (const auto& leaving_player : leaving_players) {
 		line_count = leaving_player.number;
 		interpret_player_leave(leaving_player.line);
@@ -390,13 +431,20 @@ void playlog_parser::finalize_table() {
 	line_count = original_line_count;
 	leaving_players.clear();
 	table_header.clear();
-	match.level_filename = level_filename;
-	match.game_mode = custom_mode.empty() || custom_mode == "OFF" ? game_mode : custom_mode;
+	match.level_filename = std::move(level_filename);
+	match.game_mode = std::move(custom_mode.empty() || custom_mode == "OFF" ? game_mode : custom_mode);
 	match.stats_source = stats_source;
 	stats_source = stats_type::none;
 	auto end_time = match.end_time;
-	if (!match.players.empty())
-		result.matches.push_back(std::move(match));
+	if (!match.players.empty()) {
+		player_count_hint = match.players.size();
+		if (matches_filter(match, filter)) {
+			if (match_sink)
+				match_sink(std::move(match));
+			else
+				result.matches.push_back(std::move(match));
+		}
+	}
 	match = {};
 	match.start_time = end_time;
 }
@@ -415,6 +463,14 @@ void playlog_parser::clean_up() {
 playlog_parser::playlog_parser(event_data& result)
 	: result(result) {}
 
+void playlog_parser::set_filter(match_filter new_filter) {
+	filter = std::move(new_filter);
+}
+
+void playlog_parser::set_match_sink(std::function<void(match_data&&)> sink) {
+	match_sink = std::move(sink);
+}
+
 void playlog_parser::parse(std::istream& input) {
 	std::string line;
 	while (std::getline(input, line)) {
@@ -423,3 +479,49 @@ void playlog_parser::parse(std::istream& input) {
 	}
 	clean_up();
 }
+
+void playlog_parser::parse_range(std::istream& input, std::uint64_t begin, std::uint64_t end, std::size_t first_line) {
+	input.clear();
+	input.seekg(static_cast<std::streamoff>(begin));
+	line_count = first_line - 1;
+	std::string line;
+	for (auto offset = begin; offset < end && std::getline(input, line); offset += line.size() + 1) {
+		line_count++;
+		interpret_line(line);
+	}
+	clean_up();
+}
+
+void playlog_parser::parse(std::istream& input, const std::vector<level_boundary>& levels) {
+	struct range {
+		std::uint64_t begin {};
+		std::uint64_t end {};
+		std::size_t first_line {};
+		int previous_end_time = -1;
+	};
+	constexpr auto end_of_file = std::numeric_limits<std::uint64_t>::max();
+	std::vector<range> ranges;
+	if (levels.empty() || levels.front().offset > 0)
+		ranges.push_back(range {.begin = 0, .end = levels.empty() ? end_of_file : levels.front().offset, .first_line = 1});
+	for (std::size_t i = 0; i < levels.size(); i++) {
+		const auto& level = levels[i];
+		auto next = i + 1 < levels.size() ? &levels[i + 1] : nullptr;
+		if (!level.level_filename.empty() && !level_matches_filter(level.level_filename, filter))
+			continue;
+		// The first match of the level may start before the level itself.
+		auto start = level.previous_end_time >= 0 ? level.previous_end_time : level.timestamp;
+		if (start >= 0 && next && next->timestamp >= 0 && !time_ranges_overlap(start, next->timestamp, filter))
+			continue;
+		auto end = next ? next->offset : end_of_file;
+		if (!ranges.empty() && ranges.back().end == level.offset)
+			ranges.back().end = end;
+		else
+			ranges.push_back(range {.begin = level.offset, .end = end, .first_line = level.line, .previous_end_time = level.previous_end_time});
+	}
+	for (const auto& range : ranges) {
+		// The level start line at the beginning of the range turns this into
+		// the start time of the level's first match, like in a full parse.
+		match.end_time = range.previous_end_time;
+		parse_range(input, range.begin, range.end, range.first_line);
+	}
+}
@@ -1,10 +1,29 @@
 #pragma once
+#include <cstdint>
 #include <cstdlib>
+#include <functional>
+#include <istream>
+#include <optional>
 #include <string>
 #include <string_view>
 #include <vector>
+#include "index.h"
 #include "match.h"
 
+enum class column_kind : std::uint8_t {
+	id,
+	name,
+	ip_address,
+	team,
+	stat,
+};
+
+// Bump whenever the parser or default_process produce different match data
+// for the same playlog. Results cached from parsed playlogs are keyed on it.
+constexpr std::uint32_t parser_version = 2;
+
+std::optional<std::string_view> level_filename_from_info(std::string_view value);
+
 class playlog_parser {
 private:
 	struct line_info {
@@ -13,9 +32,14 @@ private:
 	};
 	struct column_info {
 		std::string header;
+		std::string key;
+		std::string separator;
 		std::size_t size {};
+		column_kind kind {};
 	};
+	static column_info make_column(std::string header, std::size_t size = 0);
 	void report_warning(std::string_view message);
+	void report_warning(std::string_view kind, std::string message);
 	void interpret_long_timestamp_line(std::string_view line);
 	void interpret_info_line(std::string_view line);
 	void interpret_game_alert(std::string_view line, int timestamp);
@@ -24,21 +48,31 @@ private:
 	void interpret_event_line(std::string_view line);
 	void interpret_winner_line(std::string_view line);
 	void interpret_table_header_line(std::string_view line);
-	bool interpret_table_cell(std::string_view cell, std::string_view label, player_stats& stats);
+	bool interpret_table_cell(std::string_view cell, const column_info& column, player_stats& stats);
+	void add_player(player_stats&& stats);
 	void interpret_table_row_line(std::string_view line);
 	void interpret_team_score_line(std::string_view line, std::size_t name_length);
 	void interpret_line(std::string_view line);
+	void parse_range(std::istream& input, std::uint64_t begin, std::uint64_t end, std::size_t first_line);
 	void generate_table_header_from_leaving_players();
 	void finalize_table();
 	void end_level();
 	void clean_up();
 public:
 	playlog_parser(event_data& result);
+	void set_filter(match_filter new_filter);
+	// Finished matches are handed to the sink instead of being stored in the event.
+	void set_match_sink(std::function<void(match_data&&)> sink);
 	void parse(std::istream& input);
+	// Only parses the levels that can contain matches selected by the filter.
+	void parse(std::istream& input, const std::vector<level_boundary>& levels);
 private:
 	std::size_t line_count {};
 	event_data& result;
+	match_filter filter;
+	std::function<void(match_data&&)> match_sink;
 	match_data match;
+	std::size_t player_count_hint {};
 	std::string level_filename;
 	std::string game_mode;
 	std::string custom_mode;
@@ -1,14 +1,139 @@
 #include "scoring.h"
 #include <algorithm>
-#include <filesystem>
+#include <array>
+#include <cstdlib>
+#include <fstream>
 #include <functional>
-#include <iostream>
+#include <iterator>
 #include <numeric>
+#include <ranges>
+#include <tuple>
+#include <utility>
 #include <sol/sol.hpp>
+#include "diagnostics.h"
 #include "string.h"
 
-void set_up_lua(sol::state& lua, const match_data& match, const player_stats& player) {
+struct script_budget {
+    script_limits limits;
+    std::uint64_t instructions {};
+    std::size_t memory {};
+};
+
+constexpr int instruction_hook_interval = 1000;
+
+void* budgeted_alloc(void* ud, void* ptr, std::size_t old_size, std::size_t new_size) {
+    auto& budget = *static_cast<script_budget*>(ud);
+    if (!ptr)
+        old_size = 0;
+    if (new_size == 0) {
+        std::free(ptr);
+        budget.memory -= old_size;
+        return nullptr;
+    }
+    if (new_size > old_size && budget.memory - old_size + new_size > budget.limits.max_memory)
+        return nullptr;
+    void* result = std::realloc(ptr, new_size);
+    if (result)
+        budget.memory = budget.memory - old_size + new_size;
+    return result;
+}
+
+void instruction_hook(lua_State* state, lua_Debug*) {
+    void* ud;
+    lua_getallocf(state, &ud);
+    auto& budget = *static_cast<script_budget*>(ud);
+    budget.instructions += instruction_hook_interval;
+    if (budget.instructions > budget.limits.max_instructions)
+        luaL_error(state, "instruction limit exceeded");
+}
+
+struct player_view {
+    const match_data* match;
+    const player_stats* player;
+    const player_stats* current;
+};
+
+struct players_view {
+    const match_data* match;
+    const player_stats* current;
+};
+
+sol::object player_view_index(const player_view& view, std::string_view key, sol::this_state state) {
+    if (key == "current")
+        return sol::make_object(state, view.player == view.current);
+    if (key == "team")
+        return sol::make_object(state, std::string_view(view.player->team));
+    if (key == "iswinner")
+        return sol::make_object(state, is_winner(*view.match, *view.player));
+    auto it = view.player->stats.find(key);
+    if (it == view.player->stats.end())
+        return sol::make_object(state, sol::lua_nil);
+    return sol::make_object(state, it->second.value);
+}
+
+sol::object players_view_index(const players_view& view, sol::object key, sol::this_state state) {
+    if (!key.is<std::size_t>())
+        return sol::make_object(state, sol::lua_nil);
+    auto index = key.as<std::size_t>();
+    if (index == 0 || index > view.match->players.size())
+        return sol::make_object(state, sol::lua_nil);
+    return sol::make_object(state, player_view {view.match, &view.match->players[index - 1], view.current});
+}
+
+std::size_t players_view_length(const players_view& view) {
+    return view.match->players.size();
+}
+
+std::tuple<sol::object, sol::object> players_view_next(const players_view& view, sol::object key, sol::this_state state) {
+    std::size_t index = key.is<std::size_t>() ? key.as<std::size_t>() : 0;
+    if (index >= view.match->players.size())
+        return {sol::make_object(state, sol::lua_nil), sol::make_object(state, sol::lua_nil)};
+    return {sol::make_object(state, index + 1), sol::make_object(state, player_view {view.match, &view.match->players[index], view.current})};
+}
+
+// Iterates like ipairs, from 1 to #players.
+auto players_view_pairs(const players_view& view) {
+    return std::make_tuple(&players_view_next, view, sol::lua_nil);
+}
+
+constexpr std::array<std::string_view, 3> player_view_fields {"current", "team", "iswinner"};
+
+std::tuple<sol::object, sol::object> player_view_next(const player_view& view, sol::object key, sol::this_state state) {
+    std::string_view next_key = player_view_fields.front();
+    if (key.is<std::string_view>()) {
+        auto previous = key.as<std::string_view>();
+        const auto& stats = view.player->stats;
+        auto field = std::ranges::find(player_view_fields, previous);
+        auto it = field == player_view_fields.end() ? stats.upper_bound(previous) : stats.begin();
+        if (field != player_view_fields.end() && std::next(field) != player_view_fields.end()) {
+            next_key = *std::next(field);
+        } else {
+            while (it != stats.end() && std::ranges::find(player_view_fields, it->first) != player_view_fields.end()) {
+                ++it;
+            }
+            if (it == stats.end())
+                return {sol::make_object(state, sol::lua_nil), sol::make_object(state, sol::lua_nil)};
+            next_key = it->first;
+        }
+    }
+    return {sol::make_object(state, next_key), player_view_index(view, next_key, state)};
+}
+
+auto player_view_pairs(const player_view& view) {
+    return std::make_tuple(&player_view_next, view, sol::lua_nil);
+}
+
+void set_up_lua(sol::state& lua, const match_data& match) {
     lua.open_libraries(sol::lib::base, sol::lib::math, sol::lib::string, sol::lib::table);
+    lua.new_usertype<player_view>("player_view", sol::no_constructor,
+        sol::meta_function::index, player_view_index,
+        sol::meta_function::pairs, player_view_pairs
+    );
+    lua.new_usertype<players_view>("players_view", sol::no_constructor,
+        sol::meta_function::index, players_view_index,
+        sol::meta_function::length, players_view_length,
+        sol::meta_function::pairs, players_view_pairs
+    );
     lua["gamemode"] = match.game_mode;
     lua["duration"] = duration(match);
     auto team_scores_table = lua.create_table();
@@ -16,97 +141,193 @@ void set_up_lua(sol::state& lua, const match_data& match, const player_stats& pl
         team_scores_table.set(name, score);
     }
     lua["teamscores"] = std::move(team_scores_table);
-    lua["team"] = player.team;
-    lua["iswinner"] = match.team_scores.empty() ? match.winner == player.name : match.winner == player.team + " Team";
+}
+
+// Every player's run gets its own environment on top of the match's globals,
+// so that globals assigned by the script don't carry over to the next player.
+void set_up_environment(sol::environment& environment, const match_data& match, const player_stats& player) {
+    environment["team"] = player.team;
+    environment["iswinner"] = is_winner(match, player);
     for (const auto& [name, value] : player.stats) {
-        lua[to_lower(name)] = value.value;
-    }
-    auto players_table = lua.create_table();
-    for (const auto& other_player : match.players) {
-        auto stats_table = lua.create_table_with(
-            "current", &other_player == &player,
-            "team", other_player.team,
-            "iswinner", match.team_scores.empty() ? match.winner == other_player.name : match.winner == other_player.team + " Team"
-        );
-        for (const auto& [name, value] : other_player.stats) {
-            stats_table.set(to_lower(name), value.value);
+        environment[name] = value.value;
+    }
+    environment["players"] = players_view {&match, &player};
+}
+
+script_registry::script_registry(std::filesystem::path directory)
+    : directory(std::move(directory)) {
+    refresh();
+}
+
+std::vector<std::string> script_registry::refresh() {
+    std::vector<std::string> changed;
+    std::error_code ec;
+    std::filesystem::directory_iterator it(directory, ec);
+    if (ec) {
+        report_diagnostic(severity::warning, "scoring script", "couldn't open scoring script directory " + directory.string());
+        return {};
+    }
+    std::map<std::string, scoring_script, std::less<>> found;
+    for (const auto& entry : it) {
+        const auto& path = entry.path();
+        if (!entry.is_regular_file(ec) || path.extension() != ".lua")
+            continue;
+        auto name = path.stem().string();
+        auto last_write_time = entry.last_write_time(ec);
+        auto previous = scripts.find(name);
+        if (previous != scripts.end() && previous->second.last_write_time == last_write_time) {
+            found.emplace(std::move(name), std::move(previous->second));
+            continue;
         }
-        players_table.add(std::move(stats_table));
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            report_diagnostic(severity::warning, "scoring script", "couldn't read scoring script " + path.string());
+            continue;
+        }
+        std::string content(std::istreambuf_iterator<char>(file), {});
+        auto content_hash = fnv1a_hash(content);
+        if (previous != scripts.end() && previous->second.content_hash == content_hash) {
+            previous->second.last_write_time = last_write_time;
+            found.emplace(std::move(name), std::move(previous->second));
+            continue;
+        }
+        scoring_script script {
+            .chunk_name = '@' + path.string(),
+            .last_write_time = last_write_time,
+            .content_hash = content_hash,
+        };
+        sol::state lua;
+        auto loaded = lua.load(content, script.chunk_name);
+        if (!loaded.valid()) {
+            sol::error e = loaded;
+            report_diagnostic(severity::warning, "scoring script", "couldn't compile scoring script " + path.string());
+            report_diagnostic(severity::info, "scoring script", std::string(without_trailing_whitespace(e.what())));
+            if (previous != scripts.end())
+                found.emplace(std::move(name), std::move(previous->second));
+            continue;
+        }
+        sol::protected_function function = loaded;
+        script.bytecode = function.dump().as_string_view();
+        changed.push_back(name);
+        found.emplace(std::move(name), std::move(script));
+    }
+    for (const auto& name : scripts | std::views::keys) {
+        if (!found.contains(name))
+            changed.push_back(name);
     }
-    lua["players"] = std::move(players_table);
+    scripts = std::move(found);
+    return changed;
+}
+
+std::uint64_t script_registry::content_hash() const {
+    auto result = fnv1a_hash("");
+    for (const auto& [name, script] : scripts) {
+        result = fnv1a_hash(name, result);
+        result = fnv1a_hash(std::to_string(script.content_hash), result);
+    }
+    return result;
+}
+
+const script_limits& script_registry::limits() const {
+    return budget;
+}
+
+void script_registry::set_limits(const script_limits& new_limits) {
+    budget = new_limits;
+}
+
+const scoring_script* script_registry::find(std::string_view game_mode) const {
+    auto it = scripts.find(script_name(game_mode));
+    return it != scripts.end() ? &it->second : nullptr;
 }
 
-std::map<std::string, double> score_match(const match_data& match) {
+std::string script_name(std::string_view game_mode) {
+    std::string result = to_lower(game_mode);
+    std::ranges::replace(result, ' ', '_');
+    return result;
+}
+
+std::map<std::string, double> score_match(const match_data& match, const script_registry& scripts, script_statistics_map* statistics) {
     std::map<std::string, double> result;
-    std::string filename = to_lower(match.game_mode);
-    std::ranges::replace(filename, ' ', '_');
-    filename += ".lua";
-    std::filesystem::path path("scoring");
-    path /= filename;
-    if (!std::filesystem::is_regular_file(path)) {
-        std::cerr << "WARNING: no regular file named " << filename << " found\n";
+    auto name = script_name(match.game_mode);
+    const auto* script = scripts.find(match.game_mode);
+    if (!script) {
+        report_diagnostic(severity::warning, "missing scoring script", "no regular file named " + name + ".lua found");
         return {};
     }
+    script_statistics unused;
+    auto& script_stats = statistics ? (*statistics)[name] : unused;
+    // One state per match; the instruction budget still applies per player.
+    script_budget budget {.limits = scripts.limits()};
+    sol::state lua(sol::default_at_panic, budgeted_alloc, &budget);
+    sol::protected_function chunk;
     for (const auto& player : match.players) {
+        auto start = std::chrono::steady_clock::now();
+        script_stats.runs++;
         try {
-            sol::state lua;
-            set_up_lua(lua, match, player);
-            auto returned_value = lua.safe_script_file(path.string(), [](lua_State*, auto pfr) -> decltype(pfr) {
-                throw pfr.get<sol::error>();
-            });
+            budget.instructions = 0;
+            if (!chunk.valid()) {
+                set_up_lua(lua, match);
+                lua_sethook(lua.lua_state(), instruction_hook, LUA_MASKCOUNT, instruction_hook_interval);
+                auto loaded = lua.load(script->bytecode, script->chunk_name, sol::load_mode::binary);
+                if (!loaded.valid())
+                    throw loaded.get<sol::error>();
+                chunk = loaded;
+            }
+            sol::environment environment(lua, sol::create, lua.globals());
+            set_up_environment(environment, match, player);
+            environment.set_on(chunk);
+            sol::protected_function_result returned_value = chunk();
+            if (!returned_value.valid())
+                throw returned_value.get<sol::error>();
             result[player.name] = returned_value.get<double>();
+            script_stats.time += std::chrono::steady_clock::now() - start;
         } catch (const sol::error& e) {
-            std::cerr << "WARNING: error running scoring script for level " << match.level_filename << ", player " << player.name << '\n';
-            std::cerr << "INFO: " << e.what();
+            script_stats.failures++;
+            script_stats.time += std::chrono::steady_clock::now() - start;
+            report_diagnostic(severity::warning, "scoring script error", "error running scoring script for level " + match.level_filename + ", player " + player.name);
+            report_diagnostic(severity::info, "scoring script error", std::string(without_trailing_whitespace(e.what())));
             return {};
         }
     }
     return result;
 }
 
-struct game_mode_data {
-    int total_rounds {};
-    int total_time {};
-    double total_score {};
-};
-
-scoring_results score(const event_data& event) {
-    scoring_results results;
-    std::map<std::string, game_mode_data> game_modes;
-    for (const auto& match : event.matches) {
-        auto round_scores = score_match(match);
-        bool any_points = std::ranges::any_of(round_scores, [](const auto& player_score) {
-            return player_score.second != 0.0;
-        });
-        if (any_points) {
-            double total_score = 0.0;
-            auto& round = results.rounds.emplace_back();
-            round.name = match.level_filename;
-            round.game_mode = match.game_mode;
-            for (auto&& player : results.players) {
-                auto it = round_scores.find(player.name);
-                if (it != round_scores.end()) {
-                    player.scores.emplace_back(it->second);
-                    total_score += it->second;
-                    round_scores.erase(it);
-                } else {
-                    player.scores.emplace_back(std::nullopt);
-                }
-            }
-            for (const auto& [name, score] : round_scores) {
-                auto& player = results.players.emplace_back();
-                player.name = name;
-                player.scores.resize(results.rounds.size());
-                player.scores.back() = score;
-                total_score += score;
-            }
-            auto& game_mode = game_modes[round.game_mode];
-            game_mode.total_rounds++;
-            game_mode.total_time += duration(match);
-            if (total_score > 0.0)
-                game_mode.total_score += total_score;
+void score_aggregator::add_round(std::string level_filename, std::string game_mode, int duration, std::map<std::string, double> round_scores) {
+    bool any_points = std::ranges::any_of(round_scores, [](const auto& player_score) {
+        return player_score.second != 0.0;
+    });
+    if (!any_points)
+        return;
+    double total_score = 0.0;
+    auto& round = results.rounds.emplace_back();
+    round.name = std::move(level_filename);
+    round.game_mode = std::move(game_mode);
+    for (auto&& player : results.players) {
+        auto it = round_scores.find(player.name);
+        if (it != round_scores.end()) {
+            player.scores.emplace_back(it->second);
+            total_score += it->second;
+            round_scores.erase(it);
+        } else {
+            player.scores.emplace_back(std::nullopt);
         }
     }
+    for (const auto& [name, score] : round_scores) {
+        auto& player = results.players.emplace_back();
+        player.name = name;
+        player.scores.resize(results.rounds.size());
+        player.scores.back() = score;
+        total_score += score;
+    }
+    auto& game_mode_totals = game_modes[round.game_mode];
+    game_mode_totals.total_rounds++;
+    game_mode_totals.total_time += duration;
+    if (total_score > 0.0)
+        game_mode_totals.total_score += total_score;
+}
+
+scoring_results score_aggregator::finish(double max_score) {
     for (auto&& round : results.rounds) {
         const auto& game_mode = game_modes.find(round.game_mode)->second;
         if (game_mode.total_score > 0.0)
@@ -123,7 +344,7 @@ scoring_results score(const event_data& event) {
         return lhs.total > rhs.total;
     });
     if (!results.players.empty()) {
-        double global_weight = event.max_score / results.players.front().total;
+        double global_weight = max_score / results.players.front().total;
         for (auto&& round : results.rounds) {
             round.weight *= global_weight;
         }
@@ -131,5 +352,27 @@ scoring_results score(const event_data& event) {
             player.total *= global_weight;
         }
     }
-    return results;
+    game_modes.clear();
+    return std::exchange(results, {});
+}
+
+void report_script_statistics(const script_statistics_map& statistics) {
+    for (const auto& [name, stats] : statistics) {
+        std::chrono::duration<double, std::milli> time = stats.time;
+        report_diagnostic(severity::info, "scoring script statistics", "scoring script " + name + ".lua ran " + std::to_string(stats.runs) + " times (" + std::to_string(stats.failures) + " failed) in " + std::to_string(time.count()) + " ms");
+    }
+}
+
+scoring_results score(const event_data& event, const script_registry& scripts) {
+    score_aggregator aggregator;
+    script_statistics_map statistics;
+    for (const auto& match : event.matches) {
+        aggregator.add_round(match.level_filename, match.game_mode, duration(match), score_match(match, scripts, &statistics));
+    }
+    report_script_statistics(statistics);
+    return aggregator.finish(event.max_score);
+}
+
+scoring_results score(const event_data& event) {
+    return score(event, script_registry());
 }
@@ -1,4 +1,9 @@
 #pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
 #include <map>
 #include <optional>
 #include <string>
@@ -23,6 +28,66 @@ struct scoring_results {
 	std::vector<player_scores> players;
 };
 
-std::map<std::string, double> score_match(const match_data& match);
+struct scoring_script {
+	std::string chunk_name;
+	std::filesystem::file_time_type last_write_time;
+	std::uint64_t content_hash {};
+	std::string bytecode;
+};
+
+struct script_limits {
+	std::uint64_t max_instructions = 100'000'000;
+	std::size_t max_memory = 64 * 1024 * 1024;
+};
+
+struct script_statistics {
+	int runs {};
+	int failures {};
+	std::chrono::nanoseconds time {};
+};
+
+using script_statistics_map = std::map<std::string, script_statistics, std::less<>>;
+
+// Scripts are scanned and compiled once; refresh() only rereads files whose
+// modification time changed and only recompiles them if their content did.
+class script_registry {
+public:
+	explicit script_registry(std::filesystem::path directory = "scoring");
+	// Returns the names of the scripts that were added, changed or removed.
+	std::vector<std::string> refresh();
+	const scoring_script* find(std::string_view game_mode) const;
+	// Changes whenever any script is added, removed or edited.
+	std::uint64_t content_hash() const;
+	const script_limits& limits() const;
+	void set_limits(const script_limits& new_limits);
+private:
+	std::filesystem::path directory;
+	script_limits budget;
+	std::map<std::string, scoring_script, std::less<>> scripts;
+};
+
+std::string script_name(std::string_view game_mode);
+
+std::map<std::string, double> score_match(const match_data& match, const script_registry& scripts, script_statistics_map* statistics = nullptr);
+
+struct game_mode_data {
+	int total_rounds {};
+	int total_time {};
+	double total_score {};
+};
+
+// Rounds without any points are skipped. Weights are normalized per game
+// mode and then scaled so that the best player ends up with max_score.
+class score_aggregator {
+public:
+	void add_round(std::string level_filename, std::string game_mode, int duration, std::map<std::string, double> round_scores);
+	scoring_results finish(double max_score);
+private:
+	scoring_results results;
+	std::map<std::string, game_mode_data> game_modes;
+};
+
+void report_script_statistics(const script_statistics_map& statistics);
 
+scoring_results score(const event_data& event, const script_registry& scripts);
 scoring_results score(const event_data& event);
@@ -0,0 +1,174 @@
+#include "season.h"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <fstream>
+#include <map>
+#include <string_view>
+#include "binary.h"
+#include "diagnostics.h"
+#include "input.h"
+#include "match.h"
+#include "playlog.h"
+#include "string.h"
+
+constexpr std::uint32_t summary_magic = 0x5343444a;
+constexpr std::uint32_t summary_version = 1;
+
+event_summary summarize_event(const event_data& event, const scoring_results& results) {
+	std::map<std::string, ip_set, std::less<>> ips_by_name;
+	for (const auto& match : event.matches) {
+		for (const auto& player : match.players) {
+			auto ips = player.ips;
+			ips_by_name[player.name].merge(ips);
+		}
+	}
+	event_summary summary;
+	for (const auto& player : results.players) {
+		auto& summarized = summary.players.emplace_back();
+		summarized.name = player.name;
+		summarized.total = player.total;
+		if (auto it = ips_by_name.find(player.name); it != ips_by_name.end())
+			summarized.ips = std::move(it->second);
+	}
+	return summary;
+}
+
+std::optional<event_summary> load_event_summary(const std::filesystem::path& path, std::uint64_t key) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+		return std::nullopt;
+	std::uint32_t magic, version, player_count;
+	std::uint64_t stored_key;
+	event_summary summary;
+	if (!read_value(file, magic) || !read_value(file, version) || !read_value(file, stored_key))
+		return std::nullopt;
+	if (magic != summary_magic || version != summary_version || stored_key != key)
+		return std::nullopt;
+	if (!read_string(file, summary.name) || !read_count(file, player_count))
+		return std::nullopt;
+	summary.players.resize(player_count);
+	for (auto&& player : summary.players) {
+		std::uint32_t address_count, unparsed_count;
+		if (!read_string(file, player.name) || !read_value(file, player.total) || !read_count(file, address_count))
+			return std::nullopt;
+		player.ips.addresses.resize(address_count);
+		for (auto&& address : player.ips.addresses) {
+			if (!read_value(file, address.high) || !read_value(file, address.low))
+				return std::nullopt;
+		}
+		if (!read_count(file, unparsed_count))
+			return std::nullopt;
+		player.ips.unparsed.resize(unparsed_count);
+		for (auto&& ip : player.ips.unparsed) {
+			if (!read_string(file, ip))
+				return std::nullopt;
+		}
+	}
+	return summary;
+}
+
+bool save_event_summary(const std::filesystem::path& path, std::uint64_t key, const event_summary& summary) {
+	std::error_code ec;
+	std::filesystem::create_directories(path.parent_path(), ec);
+	auto temporary_path = path;
+	temporary_path += ".tmp";
+	{
+		std::ofstream file(temporary_path, std::ios::binary);
+		write_value(file, summary_magic);
+		write_value(file, summary_version);
+		write_value(file, key);
+		write_string(file, summary.name);
+		write_value(file, static_cast<std::uint32_t>(summary.players.size()));
+		for (const auto& player : summary.players) {
+			write_string(file, player.name);
+			write_value(file, player.total);
+			write_value(file, static_cast<std::uint32_t>(player.ips.addresses.size()));
+			for (const auto& address : player.ips.addresses) {
+				write_value(file, address.high);
+				write_value(file, address.low);
+			}
+			write_value(file, static_cast<std::uint32_t>(player.ips.unparsed.size()));
+			for (const auto& ip : player.ips.unparsed) {
+				write_string(file, ip);
+			}
+		}
+		if (!file)
+			return false;
+	}
+	std::filesystem::rename(temporary_path, path, ec);
+	return !ec;
+}
+
+std::optional<event_summary> process_event(const std::filesystem::path& playlog, double max_score, const script_registry& scripts) {
+	auto file = open_playlog(playlog);
+	if (!file) {
+		report_diagnostic(severity::error, "file access", "couldn't open file " + playlog.string());
+		return std::nullopt;
+	}
+	event_data event;
+	event.max_score = max_score;
+	playlog_parser parser(event);
+	parser.parse(*file);
+	default_process(event);
+	auto summary = summarize_event(event, score(event, scripts));
+	summary.name = playlog.stem().string();
+	return summary;
+}
+
+scoring_results score_season(const std::vector<std::filesystem::path>& playlogs, double max_score, const script_registry& scripts, const std::filesystem::path& cache_directory) {
+	scoring_results results;
+	std::vector<ip_set> season_ips;
+	for (const auto& playlog : playlogs) {
+		auto playlog_hash = hash_file(playlog);
+		if (!playlog_hash) {
+			report_diagnostic(severity::error, "file access", "couldn't open file " + playlog.string());
+			continue;
+		}
+		const std::array<std::uint64_t, 4> key_parts {*playlog_hash, parser_version, scripts.content_hash(), std::bit_cast<std::uint64_t>(max_score)};
+		auto key = fnv1a_hash(std::string_view(reinterpret_cast<const char*>(key_parts.data()), sizeof key_parts));
+		auto cache_path = cache_directory / (to_hex(key) + ".bin");
+		auto summary = load_event_summary(cache_path, key);
+		if (!summary) {
+			summary = process_event(playlog, max_score, scripts);
+			if (!summary)
+				continue;
+			if (!save_event_summary(cache_path, key, *summary))
+				report_diagnostic(severity::warning, "file access", "couldn't write cache file " + cache_path.string());
+		}
+		auto& round = results.rounds.emplace_back();
+		round.name = playlog.stem().string();
+		round.weight = 1.0;
+		for (auto&& player : results.players) {
+			player.scores.emplace_back(std::nullopt);
+		}
+		for (auto&& event_player : summary->players) {
+			auto it = std::ranges::find_if(results.players, [&](const player_scores& player) {
+				if (player.name == event_player.name)
+					return true;
+				const auto& ips = season_ips[&player - results.players.data()];
+				return ips.overlaps(event_player.ips) && same_player_name(player.name, event_player.name);
+			});
+			if (it == results.players.end()) {
+				it = results.players.emplace(it);
+				it->name = event_player.name;
+				it->scores.resize(results.rounds.size());
+				season_ips.emplace_back();
+			}
+			auto& score = it->scores.back();
+			score = score.value_or(0.0) + event_player.total;
+			if (is_string_with_number_suffix(it->name, event_player.name))
+				it->name = event_player.name;
+			season_ips[it - results.players.begin()].merge(event_player.ips);
+		}
+	}
+	for (auto&& player : results.players) {
+		for (const auto& score : player.scores) {
+			player.total += score.value_or(0.0);
+		}
+	}
+	std::ranges::stable_sort(results.players, [](const player_scores& lhs, const player_scores& rhs) {
+		return lhs.total > rhs.total;
+	});
+	return results;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+#include "ip.h"
+#include "scoring.h"
+
+struct event_player_summary {
+	std::string name;
+	ip_set ips;
+	double total {};
+};
+
+struct event_summary {
+	std::string name;
+	std::vector<event_player_summary> players;
+};
+
+event_summary summarize_event(const event_data& event, const scoring_results& results);
+
+std::optional<event_summary> load_event_summary(const std::filesystem::path& path, std::uint64_t key);
+bool save_event_summary(const std::filesystem::path& path, std::uint64_t key, const event_summary& summary);
+
+// Every event is normalized to max_score on its own, and the season table
+// is the sum of the event totals. Events are only reprocessed if their
+// playlog, the scoring scripts or max_score changed since the last run.
+scoring_results score_season(const std::vector<std::filesystem::path>& playlogs, double max_score, const script_registry& scripts, const std::filesystem::path& cache_directory = "JDCscores-cache");
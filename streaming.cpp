@@ -0,0 +1,254 @@
+#include "streaming.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <iterator>
+#include <limits>
+#include <utility>
+#include "binary.h"
+#include "diagnostics.h"
+#include "string.h"
+
+temporary_file::~temporary_file() {
+	if (file_path.empty())
+		return;
+	file.close();
+	std::error_code ec;
+	std::filesystem::remove(file_path, ec);
+}
+
+bool temporary_file::open() {
+	std::error_code ec;
+	auto directory = std::filesystem::temp_directory_path(ec);
+	const std::array<std::uint64_t, 2> name_parts {static_cast<std::uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count()), reinterpret_cast<std::uintptr_t>(this)};
+	auto name = fnv1a_hash(std::string_view(reinterpret_cast<const char*>(name_parts.data()), sizeof name_parts));
+	file_path = directory / ("JDCscores-" + to_hex(name) + ".tmp");
+	file.open(file_path, std::ios::in | std::ios::out | std::ios::trunc | std::ios::binary);
+	if (ec || !file) {
+		report_diagnostic(severity::warning, "file access", "couldn't create temporary file " + file_path.string());
+		file_path.clear();
+		return false;
+	}
+	return true;
+}
+
+bool temporary_file::is_open() const {
+	return file.is_open();
+}
+
+const std::filesystem::path& temporary_file::path() const {
+	return file_path;
+}
+
+std::fstream& temporary_file::stream() {
+	return file;
+}
+
+std::size_t estimated_size(const player_stats& player) {
+	auto result = sizeof player + player.name.capacity() + player.ips.addresses.capacity() * sizeof(ip_address);
+	for (const auto& ip : player.ips.unparsed) {
+		result += sizeof ip + ip.capacity();
+	}
+	return result;
+}
+
+std::size_t estimated_size(const scored_round& round) {
+	return sizeof round + round.level_filename.capacity() + round.game_mode.capacity() + round.scores.capacity() * sizeof(scored_player);
+}
+
+constexpr std::size_t identity_index_entry_size = 2 * sizeof(std::uint64_t) + 2 * sizeof(void*);
+
+std::uint64_t identity_hash(const player_stats& player) {
+	const char renamed = player.renamed;
+	auto result = fnv1a_hash(player.name);
+	result = fnv1a_hash(std::string_view(&renamed, 1), result);
+	for (const auto& address : player.ips.addresses) {
+		result = fnv1a_hash(std::string_view(reinterpret_cast<const char*>(&address), sizeof address), result);
+	}
+	for (const auto& ip : player.ips.unparsed) {
+		result = fnv1a_hash(ip, result);
+		result = fnv1a_hash(std::string_view("", 1), result);
+	}
+	return result;
+}
+
+void write_identity(std::ostream& os, const player_stats& player) {
+	write_string(os, player.name);
+	write_value(os, static_cast<std::uint8_t>(player.renamed));
+	write_value(os, static_cast<std::uint32_t>(player.ips.addresses.size()));
+	for (const auto& address : player.ips.addresses) {
+		write_value(os, address.high);
+		write_value(os, address.low);
+	}
+	write_value(os, static_cast<std::uint32_t>(player.ips.unparsed.size()));
+	for (const auto& ip : player.ips.unparsed) {
+		write_string(os, ip);
+	}
+}
+
+bool read_identity(std::istream& is, player_stats& player) {
+	std::uint8_t renamed;
+	std::uint32_t address_count, unparsed_count;
+	if (!read_string(is, player.name) || !read_value(is, renamed) || !read_count(is, address_count))
+		return false;
+	player.renamed = renamed != 0;
+	player.ips.addresses.resize(address_count);
+	for (auto&& address : player.ips.addresses) {
+		if (!read_value(is, address.high) || !read_value(is, address.low))
+			return false;
+	}
+	if (!read_count(is, unparsed_count))
+		return false;
+	player.ips.unparsed.resize(unparsed_count);
+	for (auto&& ip : player.ips.unparsed) {
+		if (!read_string(is, ip))
+			return false;
+	}
+	return true;
+}
+
+void write_scored_round(std::ostream& os, const scored_round& round) {
+	write_string(os, round.level_filename);
+	write_string(os, round.game_mode);
+	write_value(os, round.duration);
+	write_value(os, static_cast<std::uint32_t>(round.scores.size()));
+	for (const auto& score : round.scores) {
+		write_value(os, score.player);
+		write_value(os, score.score);
+	}
+}
+
+bool read_scored_round(std::istream& is, scored_round& round) {
+	std::uint32_t score_count;
+	if (!read_string(is, round.level_filename) || !read_string(is, round.game_mode) || !read_value(is, round.duration) || !read_count(is, score_count))
+		return false;
+	round.scores.resize(score_count);
+	for (auto&& score : round.scores) {
+		if (!read_value(is, score.player) || !read_value(is, score.score))
+			return false;
+	}
+	return true;
+}
+
+streaming_scorer::streaming_scorer(const script_registry& scripts, std::size_t memory_limit)
+	: scripts(scripts), memory_limit(memory_limit) {}
+
+void streaming_scorer::add_match(match_data&& match) {
+	auto_merge_players(match);
+	auto round_scores = score_match(match, scripts, &statistics);
+	add_scored_match(std::move(match), round_scores);
+}
+
+// Identities keep the index of their first occurrence, so the renames are
+// still applied in the order the players first appeared in. Spilled
+// identities can't be compared, so a player whose identity has been spilled
+// gets a new index rather than one that may belong to a colliding hash.
+std::uint64_t streaming_scorer::add_identity(player_stats&& player) {
+	player_stats identity {.name = std::move(player.name), .renamed = player.renamed, .ips = std::move(player.ips)};
+	auto index = spilled_players + players.size();
+	auto [it, inserted] = identity_indices.try_emplace(identity_hash(identity), index);
+	if (inserted) {
+		players_size += identity_index_entry_size;
+	} else if (it->second >= spilled_players && players[it->second - spilled_players] == identity) {
+		return it->second;
+	} else {
+		it->second = index;
+	}
+	players_size += estimated_size(identity);
+	players.push_back(std::move(identity));
+	return index;
+}
+
+void streaming_scorer::add_scored_match(match_data&& match, const std::map<std::string, double>& round_scores) {
+	scored_round round {.duration = duration(match)};
+	for (auto&& player : match.players) {
+		auto score = round_scores.find(player.name);
+		auto index = add_identity(std::move(player));
+		if (score != round_scores.end())
+			round.scores.push_back(scored_player {.player = index, .score = score->second});
+	}
+	bool any_points = std::ranges::any_of(round.scores, [](const scored_player& player) {
+		return player.score != 0.0;
+	});
+	if (any_points) {
+		round.level_filename = std::move(match.level_filename);
+		round.game_mode = std::move(match.game_mode);
+		rounds_size += estimated_size(round);
+		rounds.push_back(std::move(round));
+	}
+	if (players_size + rounds_size > memory_limit)
+		spill();
+}
+
+void streaming_scorer::spill() {
+	if (!spilled_round_file.is_open() && !(spilled_player_file.open() && spilled_round_file.open())) {
+		report_diagnostic(severity::warning, "memory limit", "keeping all scoring data in memory");
+		memory_limit = std::numeric_limits<std::size_t>::max();
+		return;
+	}
+	for (const auto& player : players) {
+		write_identity(spilled_player_file.stream(), player);
+	}
+	for (const auto& round : rounds) {
+		write_scored_round(spilled_round_file.stream(), round);
+	}
+	spilled_players += players.size();
+	spilled_rounds += rounds.size();
+	players_size = identity_indices.size() * identity_index_entry_size;
+	rounds_size = 0;
+	players = {};
+	rounds = {};
+}
+
+void streaming_scorer::replay(const scored_round& round, const std::vector<player_stats>& identities, score_aggregator& aggregator) const {
+	std::map<std::string, double> round_scores;
+	for (const auto& score : round.scores) {
+		if (score.player < identities.size())
+			round_scores[identities[score.player].name] = score.score;
+	}
+	aggregator.add_round(round.level_filename, round.game_mode, round.duration, std::move(round_scores));
+}
+
+scoring_results streaming_scorer::finish(double max_score) {
+	std::vector<player_stats> identities;
+	if (spilled_player_file.is_open()) {
+		auto& file = spilled_player_file.stream();
+		file.flush();
+		file.seekg(0);
+		identities.resize(spilled_players);
+		for (auto&& identity : identities) {
+			if (!read_identity(file, identity)) {
+				report_diagnostic(severity::error, "file access", "couldn't read back temporary file " + spilled_player_file.path().string());
+				break;
+			}
+		}
+	}
+	std::ranges::move(players, std::back_inserter(identities));
+	players = {};
+	identity_indices = {};
+	std::vector<player_stats*> all_players;
+	all_players.reserve(identities.size());
+	for (auto&& identity : identities) {
+		all_players.push_back(&identity);
+	}
+	auto_rename_players(all_players);
+	score_aggregator aggregator;
+	if (spilled_round_file.is_open()) {
+		auto& file = spilled_round_file.stream();
+		file.flush();
+		file.seekg(0);
+		scored_round round;
+		for (std::size_t i = 0; i < spilled_rounds; i++) {
+			if (!read_scored_round(file, round)) {
+				report_diagnostic(severity::error, "file access", "couldn't read back temporary file " + spilled_round_file.path().string());
+				break;
+			}
+			replay(round, identities, aggregator);
+		}
+	}
+	for (const auto& round : rounds) {
+		replay(round, identities, aggregator);
+	}
+	report_script_statistics(statistics);
+	return aggregator.finish(max_score);
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "match.h"
+#include "scoring.h"
+
+struct scored_player {
+	std::uint64_t player {};
+	double score {};
+};
+
+struct scored_round {
+	std::string level_filename;
+	std::string game_mode;
+	std::int32_t duration {};
+	std::vector<scored_player> scores;
+};
+
+// Removed again when it goes out of scope.
+class temporary_file {
+public:
+	temporary_file() = default;
+	temporary_file(const temporary_file&) = delete;
+	temporary_file& operator=(const temporary_file&) = delete;
+	~temporary_file();
+	bool open();
+	bool is_open() const;
+	const std::filesystem::path& path() const;
+	std::fstream& stream();
+private:
+	std::filesystem::path file_path;
+	std::fstream file;
+};
+
+// Scores every match as soon as the parser finishes it. Of the players, only
+// the identities needed for the cross-match renames (name, renamed flag and
+// IP addresses) are kept, once per distinct identity between two spills.
+// Identities and round scores are spilled to temporary files whenever the
+// data kept in memory grows beyond memory_limit bytes. finish() has to load
+// the identities back to apply the renames.
+class streaming_scorer {
+public:
+	streaming_scorer(const script_registry& scripts, std::size_t memory_limit);
+	streaming_scorer(const streaming_scorer&) = delete;
+	streaming_scorer& operator=(const streaming_scorer&) = delete;
+	void add_match(match_data&& match);
+	// For matches that have already been merged and scored.
+	void add_scored_match(match_data&& match, const std::map<std::string, double>& round_scores);
+	// Applies the renames to the collected round scores and normalizes them.
+	scoring_results finish(double max_score);
+private:
+	std::uint64_t add_identity(player_stats&& player);
+	void spill();
+	void replay(const scored_round& round, const std::vector<player_stats>& identities, score_aggregator& aggregator) const;
+	const script_registry& scripts;
+	std::size_t memory_limit;
+	std::size_t players_size {};
+	std::size_t rounds_size {};
+	std::vector<player_stats> players;
+	std::vector<scored_round> rounds;
+	// The latest index of every identity hash. Only identities still in memory
+	// are reused, and only if they compare equal.
+	std::unordered_map<std::uint64_t, std::uint64_t> identity_indices;
+	std::uint64_t spilled_players {};
+	std::size_t spilled_rounds {};
+	temporary_file spilled_player_file;
+	temporary_file spilled_round_file;
+	script_statistics_map statistics;
+};
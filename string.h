@@ -1,7 +1,9 @@
 #pragma once
 #include <algorithm>
+#include <array>
 #include <cctype>
 #include <charconv>
+#include <cstdint>
 #include <optional>
 #include <string>
 #include <string_view>
@@ -41,6 +43,10 @@ inline std::optional<int> hhmmss_to_seconds(std::string_view sv) {
 	return *hh * 3600 + *mm * 60 + *ss;
 }
 
+inline char to_lower_char(char c) {
+	return static_cast<char>(std::tolower(c & 255));
+}
+
 inline std::string to_lower(std::string_view sv) {
 	std::string result(sv);
 	for (auto&& c : result) {
@@ -49,6 +55,12 @@ inline std::string to_lower(std::string_view sv) {
 	return result;
 }
 
+inline std::string to_hex(std::uint64_t value) {
+	std::array<char, 16> buffer;
+	auto info = std::to_chars(buffer.data(), buffer.data() + buffer.size(), value, 16);
+	return std::string(buffer.data(), info.ptr);
+}
+
 inline std::string_view without_leading_whitespace(std::string_view sv) {
 	while (!sv.empty() && is_space(sv.front())) {
 		sv.remove_prefix(1);
@@ -78,3 +90,11 @@ inline bool consume_suffix(std::string_view& sv, std::string_view suffix) {
 	}
 	return false;
 }
+
+constexpr std::uint64_t fnv1a_hash(std::string_view sv, std::uint64_t hash = 0xcbf29ce484222325) {
+	for (auto c : sv) {
+		hash ^= static_cast<unsigned char>(c);
+		hash *= 0x100000001b3;
+	}
+	return hash;
+}